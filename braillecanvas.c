@@ -18,22 +18,173 @@
 #include "braillecanvas.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
 
-#define BRAILLE_PIXELS_WIDTH 2
-#define BRAILLE_PIXELS_HEIGHT 4
 #define BRAILLE_UNICODE 0x2800
+#define BRAILLE_PI 3.14159265358979323846
 
-static const uint32_t UNICODE_BRAILLE_PATTERN[4][2] = {
+const uint32_t UNICODE_BRAILLE_PATTERN[BRAILLE_PIXELS_HEIGHT][BRAILLE_PIXELS_WIDTH] = {
     {0x01, 0x08},
     {0x02, 0x10},
     {0x04, 0x20},
     {0x40, 0x80}
 };
 
-void BrailleCanvas_Create(BrailleCanvas* canvas, uint8_t X, uint8_t Y, uint8_t W, uint8_t H)
+// utf-8 encoding of every braille character: U+2800 + pattern is always 3 bytes long
+#define BRAILLE_UTF8_BYTES 3
+#define BRAILLE_UTF8(p) { (char)0xE2, (char)(0xA0 | ((p) >> 6)), (char)(0x80 | ((p) & 0x3F)) }
+#define BRAILLE_UTF8_4(p) BRAILLE_UTF8(p), BRAILLE_UTF8((p)+1), BRAILLE_UTF8((p)+2), BRAILLE_UTF8((p)+3)
+#define BRAILLE_UTF8_16(p) BRAILLE_UTF8_4(p), BRAILLE_UTF8_4((p)+4), BRAILLE_UTF8_4((p)+8), BRAILLE_UTF8_4((p)+12)
+#define BRAILLE_UTF8_64(p) BRAILLE_UTF8_16(p), BRAILLE_UTF8_16((p)+16), BRAILLE_UTF8_16((p)+32), BRAILLE_UTF8_16((p)+48)
+
+static const char BRAILLE_UTF8_TABLE[256][BRAILLE_UTF8_BYTES] = {
+    BRAILLE_UTF8_64(0), BRAILLE_UTF8_64(64), BRAILLE_UTF8_64(128), BRAILLE_UTF8_64(192)
+};
+
+static const BrailleRect EMPTY_RECT = {0, 0, 0, 0};
+static const BrailleCellStyle DEFAULT_CELL_STYLE = {TERMINAL_COLOR_DEFAULT, TERMINAL_COLOR_DEFAULT};
+
+#define sameStyle(a,b) ((a).Foreground == (b).Foreground && (a).Background == (b).Background)
+
+// PERFORMANCE COUNTERS
+// compiled out unless BRAILLE_CANVAS_STATS is defined - and then skipped by canvases without BrailleCanvas_SetStats
+//===========================================================================================
+#ifdef BRAILLE_CANVAS_STATS
+
+#if (defined(WIN32) || defined(_WIN32) || defined(__WIN32) || defined(__WIN32__))
+    #include <windows.h>
+    static uint64_t NOWNS() { LARGE_INTEGER f, t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t); return (uint64_t)(t.QuadPart * (1e9 / f.QuadPart)); }
+#else
+    #include <time.h>
+    static uint64_t NOWNS() { struct timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec; }
+#endif
+
+// where a stage began: the time, and the terminal totals
+typedef struct
 {
-    SetupTerminal(); // sets a font that accepts braille characters and changes encoding to UTF-8
+    uint64_t Time;
+    uint64_t Bytes;
+    uint64_t Escapes;
+} BrailleStageMark;
+
+static BrailleStageMark BrailleStats_Begin(BrailleCanvas* canvas, BrailleStage stage)
+{
+    BrailleStageMark mark = {0, 0, 0};
+    BrailleFrameStats* stats = canvas->Stats;
+    if (!stats)
+        return mark;
+
+    if (stats->Trace)
+        stats->Trace(canvas, stage, 1, stats->TraceObject);
+
+    Terminal_GetCounters(&mark.Bytes, &mark.Escapes);
+    mark.Time = NOWNS();
+    return mark;
+}
+
+static void BrailleStats_End(BrailleCanvas* canvas, BrailleStage stage, BrailleStageMark mark)
+{
+    BrailleFrameStats* stats = canvas->Stats;
+    if (!stats)
+        return;
+
+    stats->Nanoseconds[stage] += NOWNS() - mark.Time;
+
+    uint64_t bytes, escapes;
+    Terminal_GetCounters(&bytes, &escapes);
+    stats->BytesEmitted += bytes - mark.Bytes;
+    stats->EscapesEmitted += escapes - mark.Escapes;
+
+    if (stats->Trace)
+        stats->Trace(canvas, stage, 0, stats->TraceObject);
+}
+
+#define statsBegin(stage) BrailleStageMark stageMark##stage = BrailleStats_Begin(canvas, stage)
+#define statsEnd(stage) BrailleStats_End(canvas, stage, stageMark##stage)
+#define statsAdd(counter, n) if (canvas->Stats) canvas->Stats->counter += (n)
+
+#else
+
+#define statsBegin(stage)
+#define statsEnd(stage)
+#define statsAdd(counter, n) ((void)(n))
+
+#endif
+
+// counters are collected on the canvas while "stats" is set - NULL stops collecting them
+void BrailleCanvas_SetStats(BrailleCanvas* canvas, BrailleFrameStats* stats)
+{
+    canvas->Stats = stats;
+}
+
+// zeroes the counters, keeping the tracer
+void BrailleFrameStats_Reset(BrailleFrameStats* stats)
+{
+    memset(stats->PixelsWritten, 0, sizeof(stats->PixelsWritten));
+    memset(stats->Nanoseconds, 0, sizeof(stats->Nanoseconds));
+    stats->CellsEncoded = 0;
+    stats->BytesEmitted = 0;
+    stats->EscapesEmitted = 0;
+}
+//===========================================================================================
+
+// grows the rectangle to include another rectangle
+void BrailleRect_Union(BrailleRect* rect, const BrailleRect* other)
+{
+    if (other->Right <= other->Left || other->Bottom <= other->Top)
+        return;
+
+    if (rect->Right <= rect->Left || rect->Bottom <= rect->Top)
+    {
+        *rect = *other;
+        return;
+    }
+
+    rect->Left = min(rect->Left, other->Left);
+    rect->Top = min(rect->Top, other->Top);
+    rect->Right = max(rect->Right, other->Right);
+    rect->Bottom = max(rect->Bottom, other->Bottom);
+}
+
+// shrinks the rectangle to the part it shares with another rectangle
+void BrailleRect_Intersect(BrailleRect* rect, const BrailleRect* other)
+{
+    rect->Left = max(rect->Left, other->Left);
+    rect->Top = max(rect->Top, other->Top);
+    rect->Right = min(rect->Right, other->Right);
+    rect->Bottom = min(rect->Bottom, other->Bottom);
+
+    if (rect->Right <= rect->Left || rect->Bottom <= rect->Top)
+        *rect = EMPTY_RECT;
+}
+
+// number of bytes in the pixel buffer for the storage mode of the canvas
+static size_t BrailleCanvas_BufferSize(BrailleCanvas* canvas)
+{
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED)
+        return (size_t)canvas->CharacterWidth * canvas->CharacterHeight;
+    else
+        return (size_t)canvas->PixelsWidth * canvas->PixelsHeight;
+}
+
+static uint8_t BrailleCanvas_Defer(BrailleCanvas*, BrailleCommandType, int32_t, int32_t, int32_t, int32_t);
+static uint8_t BrailleCanvas_DeferData(BrailleCanvas*, BrailleCommandType, int32_t, int32_t, int32_t, int32_t, const int32_t* data, uint32_t words);
+
+void BrailleCanvas_Create(BrailleCanvas* canvas, uint16_t X, uint16_t Y, uint16_t W, uint16_t H)
+{
+    BrailleCanvas_CreateEx(canvas, X, Y, W, H, BRAILLE_STORAGE_PIXELS);
+}
 
+void BrailleCanvas_CreateEx(BrailleCanvas* canvas, uint16_t X, uint16_t Y, uint16_t W, uint16_t H, BrailleCanvasStorage storage)
+{
+    BrailleCanvas_CreateVirtual(canvas, X, Y, W, H, W, H, storage);
+}
+
+// the canvas itself, without the terminal
+static void BrailleCanvas_Init(BrailleCanvas* canvas, uint16_t X, uint16_t Y, uint16_t viewWidth, uint16_t viewHeight, uint16_t W, uint16_t H, BrailleCanvasStorage storage)
+{
     canvas->CharacterTop = Y;
     canvas->CharacterLeft = X;
     canvas->CharacterWidth = W;
@@ -43,199 +194,2448 @@ void BrailleCanvas_Create(BrailleCanvas* canvas, uint8_t X, uint8_t Y, uint8_t W
     canvas->PixelsWidth = canvas->CharacterWidth*BRAILLE_PIXELS_WIDTH;
     canvas->PixelsHeight = canvas->CharacterHeight*BRAILLE_PIXELS_HEIGHT;
 
+    // the window starts at the top-left corner
+    canvas->ViewColumn = 0;
+    canvas->ViewRow = 0;
+    canvas->ViewWidth = min(viewWidth, W);
+    canvas->ViewHeight = min(viewHeight, H);
+
     // default style
     canvas->FillStyle = CONSOLE_STYLE_TEXT_WHITE;
     canvas->BackgroundStyle = CONSOLE_STYLE_BACKGROUND_RED;
 
     // allocate a buffer for the pixel information
-    canvas->PixelBuffer = (uint8_t*)calloc(canvas->PixelsHeight * canvas->PixelsWidth, sizeof(uint8_t)); // allocate memory for rows (Y=0...H)
+    canvas->Storage = storage;
+    canvas->PixelBuffer = (uint8_t*)calloc(BrailleCanvas_BufferSize(canvas), sizeof(uint8_t)); // one byte per pixel, or one byte per cell when packed
+
+    // nothing was printed yet - the first incremental render will print everything
+    canvas->FrontBuffer = (uint8_t*)calloc(canvas->ViewWidth * canvas->ViewHeight, sizeof(uint8_t));
+    canvas->FrontValid = 0;
+    canvas->FrontWidth = 0;
+    canvas->FrontHeight = 0;
+
+    canvas->Dirty = EMPTY_RECT;
+    canvas->Ink = EMPTY_RECT;
+
+    // single style until the color plane is enabled
+    canvas->StylePlane = NULL;
+    canvas->FrontStyles = NULL;
+    canvas->Pen = DEFAULT_CELL_STYLE;
+
+    // draw immediately, anywhere in the canvas
+    canvas->Clip = (BrailleRect){0, 0, canvas->CharacterWidth, canvas->CharacterHeight};
+    canvas->Commands = NULL;
+    canvas->CommandCount = 0;
+    canvas->CommandCapacity = 0;
+    canvas->Workers = NULL;
+    canvas->Recording = NULL;
+    canvas->Stats = NULL;
 
     BrailleCanvas_WipeClean(canvas); // make sure no memory garbage on the recently allocated blocks
 }
 
+// a canvas of W x H characters, of which a window of viewWidth x viewHeight is printed at (X,Y) - see BrailleCanvas_SetView
+void BrailleCanvas_CreateVirtual(BrailleCanvas* canvas, uint16_t X, uint16_t Y, uint16_t viewWidth, uint16_t viewHeight, uint16_t W, uint16_t H, BrailleCanvasStorage storage)
+{
+    SetupTerminal(); // sets a font that accepts braille characters and changes encoding to UTF-8
+    BrailleCanvas_Init(canvas, X, Y, viewWidth, viewHeight, W, H, storage);
+}
+
+// a canvas of W x H characters that is never printed (a drawing surface, a cache): the terminal is left alone
+void BrailleCanvas_CreateOffscreen(BrailleCanvas* canvas, uint16_t W, uint16_t H, BrailleCanvasStorage storage)
+{
+    BrailleCanvas_Init(canvas, 0, 0, 0, 0, W, H, storage);
+}
+
 // frees the resources used by the canvas
 void BrailleCanvas_Destroy(BrailleCanvas* canvas)
 {
+    BrailleCanvas_SetThreads(canvas, 0); // stops the workers
+    free(canvas->Commands);
     free(canvas->PixelBuffer);
+    free(canvas->FrontBuffer);
+    free(canvas->StylePlane);
+    free(canvas->FrontStyles);
 }
 
-// sets all pixels to 0
-void BrailleCanvas_WipeClean(BrailleCanvas* canvas)
+// copies the top-left corner shared by two grids of "size"-byte elements
+static void BrailleCanvas_CopyOverlap(void* to, size_t toWidth, size_t toHeight, const void* from, size_t fromWidth, size_t fromHeight, size_t size)
 {
-    memset(canvas->PixelBuffer, 0, canvas->PixelsWidth * canvas->PixelsHeight * sizeof(uint8_t));
+    for (size_t row = 0; row < min(toHeight, fromHeight); row++)
+        memcpy((uint8_t*)to + row*toWidth*size, (const uint8_t*)from + row*fromWidth*size, min(toWidth, fromWidth)*size);
 }
 
-#define setPixel(x,y) canvas->PixelBuffer[(x) + (y)*canvas->PixelsWidth] = 1; // unsafe set pixel in buffer (may overflow)
-#define safeSetPixel(x, y) if (x < canvas->PixelsWidth && y < canvas->PixelsHeight) setPixel(x,y) // safe set pixel (some functions have betters ways to prevent overflow ... such as "break" statements )
-#define getPixel(x,y) (canvas->PixelBuffer[(x) + (y)*canvas->PixelsWidth])
-
-void BrailleCanvas_GetCharacter(BrailleCanvas* canvas, uint16_t row, uint16_t col, uint32_t * unicode)
+// changes the size of the window, keeping what is on screen in the part both sizes share
+static void BrailleCanvas_ResizeFront(BrailleCanvas* canvas, uint16_t W, uint16_t H)
 {
-    uint16_t x = col*BRAILLE_PIXELS_WIDTH;
-    uint16_t y = row*BRAILLE_PIXELS_HEIGHT;
+    if (W == canvas->ViewWidth && H == canvas->ViewHeight)
+        return;
 
-    *unicode = BRAILLE_UNICODE;
+    uint8_t* front = (uint8_t*)calloc(W * H, sizeof(uint8_t));
+    BrailleCanvas_CopyOverlap(front, W, H, canvas->FrontBuffer, canvas->ViewWidth, canvas->ViewHeight, sizeof(uint8_t));
+    free(canvas->FrontBuffer);
+    canvas->FrontBuffer = front;
 
-    // build the unicode code-point by matching the pixels in the block with the braille pattern
-    *unicode += UNICODE_BRAILLE_PATTERN[0][0]*getPixel(x+0,y+0);  *unicode += UNICODE_BRAILLE_PATTERN[0][1]*getPixel(x+1,y+0);
-    *unicode += UNICODE_BRAILLE_PATTERN[1][0]*getPixel(x+0,y+1);  *unicode += UNICODE_BRAILLE_PATTERN[1][1]*getPixel(x+1,y+1);
-    *unicode += UNICODE_BRAILLE_PATTERN[2][0]*getPixel(x+0,y+2);  *unicode += UNICODE_BRAILLE_PATTERN[2][1]*getPixel(x+1,y+2);
-    *unicode += UNICODE_BRAILLE_PATTERN[3][0]*getPixel(x+0,y+3);  *unicode += UNICODE_BRAILLE_PATTERN[3][1]*getPixel(x+1,y+3);
+    if (canvas->FrontStyles)
+    {
+        BrailleCellStyle* styles = (BrailleCellStyle*)calloc(W * H, sizeof(BrailleCellStyle));
+        BrailleCanvas_CopyOverlap(styles, W, H, canvas->FrontStyles, canvas->ViewWidth, canvas->ViewHeight, sizeof(BrailleCellStyle));
+        free(canvas->FrontStyles);
+        canvas->FrontStyles = styles;
+    }
+
+    // the exposed cells, a strip on the right and a strip at the bottom, were never printed
+    canvas->FrontWidth = min(canvas->FrontWidth, W);
+    canvas->FrontHeight = min(canvas->FrontHeight, H);
+
+    BrailleRect right = {canvas->ViewColumn + canvas->ViewWidth, canvas->ViewRow, canvas->ViewColumn + W, canvas->ViewRow + min(canvas->ViewHeight, H)};
+    BrailleRect bottom = {canvas->ViewColumn, canvas->ViewRow + canvas->ViewHeight, canvas->ViewColumn + W, canvas->ViewRow + H};
+    BrailleRect_Union(&canvas->Dirty, &right);
+    BrailleRect_Union(&canvas->Dirty, &bottom);
+
+    canvas->ViewWidth = W;
+    canvas->ViewHeight = H;
 }
 
-// converts pixel groups to braille characters and prints them on screen, character by character
-void BrailleCanvas_Render_ByCallback(BrailleCanvas* canvas, void* object,void(*SetFunc)(uint8_t, uint8_t, uint8_t, uint8_t, char*, void*))
+// moves the window printed on the terminal to another part of the canvas, and/or changes its size (in characters)
+// nothing is rasterized again: the next incremental render prints the cells whose braille character differs from the screen
+void BrailleCanvas_SetView(BrailleCanvas* canvas, int32_t column, int32_t row, uint16_t W, uint16_t H)
 {
-    // WARNING
-    // BACAUSE THIS FUNCTION IS INTENDED TO BE USED NESTED INSIDE ANOTHER RENDERING FUNCTION, IT WILL NOT CHANGE THE CURSOR POSTION OR THE CONSOLE STYLE
-    char utf8[5];
-    for (int16_t row = 0; row < canvas->CharacterHeight; row++)
+    W = min(W, canvas->CharacterWidth);
+    H = min(H, canvas->CharacterHeight);
+    column = max(min(column, canvas->CharacterWidth - W), 0);
+    row = max(min(row, canvas->CharacterHeight - H), 0);
+
+    BrailleCanvas_ResizeFront(canvas, W, H);
+
+    if (column != canvas->ViewColumn || row != canvas->ViewRow)
     {
-        for (int16_t col = 0; col < canvas->CharacterWidth; col++)
-        {
-            uint32_t unicode;
-            BrailleCanvas_GetCharacter(canvas, row, col, &unicode);
+        canvas->ViewColumn = column;
+        canvas->ViewRow = row;
 
-            if (unicode != BRAILLE_UNICODE)
-            {
-                utf8_encode(&utf8[0], unicode);
-                SetFunc(col,row,canvas->CharacterWidth,canvas->CharacterHeight,utf8,object);
-            }
-        }
+        BrailleRect view = {column, row, column + W, row + H};
+        BrailleRect_Union(&canvas->Dirty, &view); // every cell of the window may show something else now
     }
 }
 
-// converts pixel groups to braille characters and prints them on screen, row by row
-void BrailleCanvas_Render(BrailleCanvas* canvas)
+// changes the size of the canvas (in characters), keeping the pixels, colors and screen state of the part both sizes share
+// a window showing the whole canvas follows the new size, and only the newly exposed cells are printed by the next incremental render
+// the cells given up by a smaller canvas are left on screen
+void BrailleCanvas_Resize(BrailleCanvas* canvas, uint16_t W, uint16_t H)
 {
-    Terminal_SaveCursorPosition(); // let's save the current state before we do anything
+    BrailleCanvas_Flush(canvas); // queued calls were made for the old size
 
-    Terminal_SetStyle(canvas->FillStyle, canvas->BackgroundStyle); // set the style
-    Terminal_ClearArea(canvas->CharacterLeft, canvas->CharacterTop, canvas->CharacterWidth, canvas->CharacterHeight); // erase previous render
+    if (W == canvas->CharacterWidth && H == canvas->CharacterHeight)
+        return;
 
-    char utf8[5]; // holds the bytes to encode one single braille character
-    char print_line_buffer[canvas->CharacterWidth * 5]; // buffer an entire row - it's faster than printing one character at a time
+    uint16_t oldWidth = canvas->CharacterWidth;
+    uint16_t oldHeight = canvas->CharacterHeight;
+    int32_t oldPixelsWidth = canvas->PixelsWidth;
+    int32_t oldPixelsHeight = canvas->PixelsHeight;
+    uint8_t fullClip = canvas->Clip.Left == 0 && canvas->Clip.Top == 0 && canvas->Clip.Right == oldWidth && canvas->Clip.Bottom == oldHeight;
+    uint8_t fullView = canvas->ViewColumn == 0 && canvas->ViewRow == 0 && canvas->ViewWidth == oldWidth && canvas->ViewHeight == oldHeight;
 
-    for (int16_t row = 0; row < canvas->CharacterHeight; row++) // iterate over the rows and print along the lines (natural printing left to right)
-    {
-        memset(print_line_buffer, 0, sizeof(print_line_buffer)); // get rid of values from the last cycle
+    canvas->CharacterWidth = W;
+    canvas->CharacterHeight = H;
+    canvas->PixelsWidth = W*BRAILLE_PIXELS_WIDTH;
+    canvas->PixelsHeight = H*BRAILLE_PIXELS_HEIGHT;
 
-        for (int16_t col = 0; col < canvas->CharacterWidth; col++)
-        {
-            // coordinates of the top-left-most pixel in the braille dot-pattern
-            uint32_t unicode;
-            BrailleCanvas_GetCharacter(canvas, row, col, &unicode);
+    // the pixels: one row of the buffer is a row of pixels, or a row of cells when packed
+    uint8_t* pixels = (uint8_t*)calloc(BrailleCanvas_BufferSize(canvas), sizeof(uint8_t));
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED)
+        BrailleCanvas_CopyOverlap(pixels, W, H, canvas->PixelBuffer, oldWidth, oldHeight, sizeof(uint8_t));
+    else
+        BrailleCanvas_CopyOverlap(pixels, canvas->PixelsWidth, canvas->PixelsHeight, canvas->PixelBuffer, oldPixelsWidth, oldPixelsHeight, sizeof(uint8_t));
 
-            if (unicode != BRAILLE_UNICODE) // only plot unicode if there is an actual symbol ...
-            {
-                utf8_encode(&utf8[0], unicode); // tranform code-point to utf8
-                strcat(print_line_buffer, utf8); // append character to the line
-            }
-            else
-                strcat(print_line_buffer, " "); // blank braille symbols will be an ascii empty space
-        }
+    free(canvas->PixelBuffer);
+    canvas->PixelBuffer = pixels;
 
-        Terminal_SetCursorPosition(canvas->CharacterLeft, canvas->CharacterTop + row); // move to the correct row
-        fwrite(print_line_buffer, strlen(print_line_buffer)*sizeof(char), 1, stdout); // faster than printf
-        //printf("%s", print_line_buffer); // print one row
+    if (canvas->StylePlane)
+    {
+        BrailleCellStyle* styles = (BrailleCellStyle*)calloc((size_t)W * H, sizeof(BrailleCellStyle));
+        BrailleCanvas_CopyOverlap(styles, W, H, canvas->StylePlane, oldWidth, oldHeight, sizeof(BrailleCellStyle));
+        free(canvas->StylePlane);
+        canvas->StylePlane = styles;
     }
 
-    Terminal_RestoreCursorSavedPosition(); // move the cursor back to where it was before
+    // the rectangles can't reach beyond the new size - a clip covering the whole canvas keeps doing so
+    BrailleRect all = {0, 0, W, H};
+    BrailleRect_Intersect(&canvas->Dirty, &all);
+    BrailleRect_Intersect(&canvas->Ink, &all);
+    BrailleRect_Intersect(&canvas->Clip, &all);
+
+    if (fullClip)
+        canvas->Clip = all;
+
+    if (fullView)
+        BrailleCanvas_SetView(canvas, 0, 0, W, H);
+    else
+        BrailleCanvas_SetView(canvas, canvas->ViewColumn, canvas->ViewRow, canvas->ViewWidth, canvas->ViewHeight); // keep it inside the canvas
 }
 
-void BrailleCanvas_FillRectangle(BrailleCanvas* canvas, uint16_t X, uint16_t Y, uint16_t W, uint16_t H)
+// forgets what is on screen, so the next incremental render reprints the whole canvas
+void BrailleCanvas_Invalidate(BrailleCanvas* canvas)
 {
-    for (uint16_t currX = X; currX < min(X+W, canvas->PixelsWidth-1); currX++)
-        for (uint16_t currY = Y; currY < min(Y+H, canvas->PixelsHeight-1); currY++)
-            setPixel(currX,currY);
+    canvas->FrontValid = 0;
+    BrailleCanvas_MarkDirty(canvas, 0, 0, canvas->PixelsWidth, canvas->PixelsHeight);
 }
 
-void BrailleCanvas_StrokeRectangle(BrailleCanvas* canvas, uint16_t X, uint16_t Y, uint16_t W, uint16_t H)
+// records that the pixels in the inclusive box (x0,y0)-(x1,y1) were touched - the box is clipped to the canvas
+static void BrailleCanvas_MarkPixels(BrailleCanvas* canvas, int x0, int y0, int x1, int y1, uint8_t ink)
 {
-    BrailleCanvas_StrokeLine(canvas, X, Y, X, Y+H); // left side
-    BrailleCanvas_StrokeLine(canvas, X+W, Y, X+W, Y+H); // right side
-    BrailleCanvas_StrokeLine(canvas, X, Y, X+W, Y); // top side
-    BrailleCanvas_StrokeLine(canvas, X, Y+H, X+W, Y+H); // bottom side
+    x0 = max(x0, 0);
+    y0 = max(y0, 0);
+    x1 = min(x1, canvas->PixelsWidth - 1);
+    y1 = min(y1, canvas->PixelsHeight - 1);
+
+    if (x1 < x0 || y1 < y0)
+        return;
+
+    BrailleRect cells = {
+        x0 / BRAILLE_PIXELS_WIDTH,
+        y0 / BRAILLE_PIXELS_HEIGHT,
+        x1 / BRAILLE_PIXELS_WIDTH + 1,
+        y1 / BRAILLE_PIXELS_HEIGHT + 1
+    };
+
+    BrailleRect_Union(&canvas->Dirty, &cells);
+    if (ink)
+        BrailleRect_Union(&canvas->Ink, &cells);
 }
 
-// Bresenham's circle algorithm
-void BrailleCanvas_BresenhamCircle(BrailleCanvas* canvas, uint16_t x0, uint16_t y0, uint16_t r, uint8_t fillOrStroke)
+// for code that writes the PixelBuffer directly: marks a pixel-measured area as changed
+void BrailleCanvas_MarkDirty(BrailleCanvas* canvas, int32_t X, int32_t Y, int32_t W, int32_t H)
 {
-    int f = 1 - r;
-    int ddF_x = 1;
-    int ddF_y = -2 * r;
-    int x = 0;
-    int y = r;
+    if (W > 0 && H > 0)
+        BrailleCanvas_MarkPixels(canvas, X, Y, X + W - 1, Y + H - 1, 1);
+}
 
-    if (fillOrStroke)
+// gives every cell its own colors - all cells start with the canvas style
+void BrailleCanvas_EnableStylePlane(BrailleCanvas* canvas)
+{
+    if (canvas->StylePlane)
+        return;
+
+    size_t cells = (size_t)canvas->CharacterWidth * canvas->CharacterHeight;
+    canvas->StylePlane = (BrailleCellStyle*)calloc(cells, sizeof(BrailleCellStyle)); // zero is TERMINAL_COLOR_DEFAULT
+    canvas->FrontStyles = (BrailleCellStyle*)calloc(canvas->ViewWidth * canvas->ViewHeight, sizeof(BrailleCellStyle));
+
+    BrailleCanvas_Invalidate(canvas); // the screen was printed without the plane
+}
+
+// colors stamped on the cells touched by the drawing functions that follow
+void BrailleCanvas_SetPen(BrailleCanvas* canvas, TerminalColor foreground, TerminalColor background)
+{
+    canvas->Pen.Foreground = foreground;
+    canvas->Pen.Background = background;
+}
+
+void BrailleCanvas_SetCellStyle(BrailleCanvas* canvas, uint16_t col, uint16_t row, TerminalColor foreground, TerminalColor background)
+{
+    if (!canvas->StylePlane || col >= canvas->CharacterWidth || row >= canvas->CharacterHeight)
+        return;
+
+    BrailleCellStyle* style = &canvas->StylePlane[col + (size_t)row*canvas->CharacterWidth];
+    style->Foreground = foreground;
+    style->Background = background;
+
+    BrailleCanvas_MarkPixels(canvas, col*BRAILLE_PIXELS_WIDTH, row*BRAILLE_PIXELS_HEIGHT, col*BRAILLE_PIXELS_WIDTH, row*BRAILLE_PIXELS_HEIGHT, 0);
+}
+
+// sets all pixels to 0
+void BrailleCanvas_WipeClean(BrailleCanvas* canvas)
+{
+    BrailleCanvas_Flush(canvas); // queued drawing happened before the wipe
+
+    // only the cells that may hold pixels need to be erased
+    BrailleRect ink = canvas->Ink;
+    if (ink.Right <= ink.Left || ink.Bottom <= ink.Top)
+        return;
+
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED)
     {
-        //BrailleCanvas_StrokeLine(canvas, x0, y0 + r, x0, y0 - r);
-        BrailleCanvas_StrokeLine(canvas, x0 + r, y0, x0 - r, y0);
+        for (uint16_t row = ink.Top; row < ink.Bottom; row++)
+            memset(&canvas->PixelBuffer[ink.Left + (size_t)row*canvas->CharacterWidth], 0, ink.Right - ink.Left);
     }
     else
     {
-        safeSetPixel (x0, y0 + r);
-        safeSetPixel (x0, y0 - r);
-        safeSetPixel (x0 + r, y0);
-        safeSetPixel (x0 - r, y0);
+        for (int32_t y = ink.Top*BRAILLE_PIXELS_HEIGHT; y < ink.Bottom*BRAILLE_PIXELS_HEIGHT; y++)
+            memset(&canvas->PixelBuffer[ink.Left*BRAILLE_PIXELS_WIDTH + (size_t)y*canvas->PixelsWidth], 0, (ink.Right - ink.Left)*BRAILLE_PIXELS_WIDTH);
     }
 
-    while (x < y)
+    BrailleRect_Union(&canvas->Dirty, &ink); // what was erased must be printed again
+    canvas->Ink = EMPTY_RECT;
+}
+
+// moves a plane of "width" x "height" elements of "size" bytes by (dx, dy) elements - what moves in is zero
+static void BrailleCanvas_ShiftPlane(uint8_t* plane, int32_t width, int32_t height, size_t size, int32_t dx, int32_t dy)
+{
+    size_t stride = (size_t)width * size;
+    size_t keep = (size_t)(width - abs(dx)) * size;
+    size_t gap = (size_t)abs(dx) * size;
+
+    // rows are visited so that none is overwritten before it is copied
+    for (int32_t i = 0; i < height; i++)
     {
-        if (f >= 0)
+        int32_t y = dy > 0 ? height - 1 - i : i;
+        uint8_t* row = plane + (size_t)y * stride;
+
+        if (y - dy < 0 || y - dy >= height)
         {
-          y--;
-          ddF_y += 2;
-          f += ddF_y;
+            memset(row, 0, stride);
+            continue;
         }
 
-        x++;
-        ddF_x += 2;
-        f += ddF_x;
-
-        if (fillOrStroke)
+        uint8_t* source = plane + (size_t)(y - dy) * stride;
+        if (dx >= 0)
         {
-            BrailleCanvas_StrokeLine(canvas, x0 + x, y0 + y, x0 - x, y0 + y);
-            BrailleCanvas_StrokeLine(canvas, x0 + x, y0 - y, x0 - x, y0 - y);
-
-            BrailleCanvas_StrokeLine(canvas, x0 + y, y0 + x, x0 - y, y0 + x);
-            BrailleCanvas_StrokeLine(canvas, x0 + y, y0 - x, x0 - y, y0 - x);
+            memmove(row + gap, source, keep);
+            memset(row, 0, gap);
         }
         else
         {
-            safeSetPixel (x0 + x, y0 + y);
-            safeSetPixel (x0 - x, y0 + y);
+            memmove(row, source + gap, keep);
+            memset(row + keep, 0, gap);
+        }
+    }
+}
 
-            safeSetPixel (x0 + x, y0 - y);
-            safeSetPixel (x0 - x, y0 - y);
+// moves the pixels and colors by "columns" and "rows" whole cells (negative: left and up), ignoring the clip rectangle
+// the cells moved in are blank - scrolling by whole cells keeps every braille pattern intact, so nothing is rasterized again
+void BrailleCanvas_ShiftCells(BrailleCanvas* canvas, int32_t columns, int32_t rows)
+{
+    BrailleCanvas_Flush(canvas); // queued drawing happened before the shift
 
-            safeSetPixel (x0 + y, y0 + x);
-            safeSetPixel (x0 - y, y0 + x);
+    if (columns == 0 && rows == 0)
+        return;
 
-            safeSetPixel (x0 + y, y0 - x);
-            safeSetPixel (x0 - y, y0 - x);
-        }
+    int32_t width = canvas->CharacterWidth, height = canvas->CharacterHeight;
+    uint8_t outside = abs(columns) >= width || abs(rows) >= height; // everything moves out
+
+    // the colors move whether the cells hold pixels or not, so every cell may look different
+    if (canvas->StylePlane)
+    {
+        if (outside) // zero is TERMINAL_COLOR_DEFAULT
+            memset(canvas->StylePlane, 0, (size_t)width * height * sizeof(BrailleCellStyle));
+        else
+            BrailleCanvas_ShiftPlane((uint8_t*)canvas->StylePlane, width, height, sizeof(BrailleCellStyle), columns, rows);
+
+        BrailleRect all = {0, 0, width, height};
+        BrailleRect_Union(&canvas->Dirty, &all);
+    }
+
+    if (outside)
+    {
+        BrailleCanvas_WipeClean(canvas);
+        return;
     }
+
+    BrailleRect ink = canvas->Ink;
+    if (ink.Right <= ink.Left || ink.Bottom <= ink.Top)
+        return;
+
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED)
+        BrailleCanvas_ShiftPlane(canvas->PixelBuffer, width, height, 1, columns, rows);
+    else
+        BrailleCanvas_ShiftPlane(canvas->PixelBuffer, canvas->PixelsWidth, canvas->PixelsHeight, 1, columns*BRAILLE_PIXELS_WIDTH, rows*BRAILLE_PIXELS_HEIGHT);
+
+    // the ink moves along, and every cell it covered before or covers now is changed
+    BrailleRect_Union(&canvas->Dirty, &ink);
+
+    BrailleRect bounds = {0, 0, width, height};
+    ink = (BrailleRect){
+        min(max(ink.Left + columns, 0), width),
+        min(max(ink.Top + rows, 0), height),
+        min(max(ink.Right + columns, 0), width),
+        min(max(ink.Bottom + rows, 0), height)
+    };
+    BrailleRect_Intersect(&ink, &bounds); // empty if it all moved out
+
+    canvas->Ink = ink;
+    BrailleRect_Union(&canvas->Dirty, &ink);
+}
+
+// packed storage: index of the cell holding the pixel and the bit of the pixel inside that cell
+#define packedIndex(x,y) (((x) / BRAILLE_PIXELS_WIDTH) + (size_t)((y) / BRAILLE_PIXELS_HEIGHT)*canvas->CharacterWidth)
+#define packedMask(x,y) ((uint8_t)UNICODE_BRAILLE_PATTERN[(y) % BRAILLE_PIXELS_HEIGHT][(x) % BRAILLE_PIXELS_WIDTH])
+
+// unsafe set pixel in buffer (may overflow)
+static inline void setPixel(BrailleCanvas* canvas, uint32_t x, uint32_t y)
+{
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED)
+        canvas->PixelBuffer[packedIndex(x,y)] |= packedMask(x,y);
+    else
+        canvas->PixelBuffer[x + (size_t)y*canvas->PixelsWidth] = 1;
+
+    if (canvas->StylePlane)
+        canvas->StylePlane[packedIndex(x,y)] = canvas->Pen;
+}
+
+// unsafe clear pixel in buffer (may overflow)
+static inline void clearPixel(BrailleCanvas* canvas, uint32_t x, uint32_t y)
+{
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED)
+        canvas->PixelBuffer[packedIndex(x,y)] &= ~packedMask(x,y);
+    else
+        canvas->PixelBuffer[x + (size_t)y*canvas->PixelsWidth] = 0;
+}
+
+// unsafe read pixel from buffer (may overflow) - returns 0 or 1
+static inline uint8_t getPixel(BrailleCanvas* canvas, uint32_t x, uint32_t y)
+{
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED)
+        return (canvas->PixelBuffer[packedIndex(x,y)] & packedMask(x,y)) != 0;
+    else
+        return canvas->PixelBuffer[x + (size_t)y*canvas->PixelsWidth];
 }
 
-void BrailleCanvas_FillCircle(BrailleCanvas* canvas, uint16_t X, uint16_t Y, uint16_t R) { BrailleCanvas_BresenhamCircle(canvas, X, Y, R, 1); }
-void BrailleCanvas_StrokeCircle(BrailleCanvas* canvas, uint16_t X, uint16_t Y, uint16_t R) { BrailleCanvas_BresenhamCircle(canvas, X, Y, R, 0); }
+// true if the pixel is inside the clip rectangle (which is never larger than the canvas)
+static inline uint8_t insideClip(BrailleCanvas* canvas, int x, int y)
+{
+    return x >= canvas->Clip.Left*BRAILLE_PIXELS_WIDTH && x < canvas->Clip.Right*BRAILLE_PIXELS_WIDTH &&
+           y >= canvas->Clip.Top*BRAILLE_PIXELS_HEIGHT && y < canvas->Clip.Bottom*BRAILLE_PIXELS_HEIGHT;
+}
 
-// Bresenham's line algorithm
-void BrailleCanvas_StrokeLine(BrailleCanvas* canvas, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1)
+// safe set pixel (some functions have betters ways to prevent overflow ... such as "break" statements ) - returns 1 if the pixel was set
+static inline uint8_t safeSetPixel(BrailleCanvas* canvas, int x, int y)
 {
-    int dx =  abs (x1 - x0), sx = x0 < x1 ? 1 : -1;
-    int dy = -abs (y1 - y0), sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy, e2;
+    if (!insideClip(canvas, x, y))
+        return 0;
 
-    for (;;)
+    setPixel(canvas, x, y);
+    return 1;
+}
+
+void BrailleCanvas_SetPixel(BrailleCanvas* canvas, int32_t x, int32_t y)
+{
+    BrailleCanvas_Flush(canvas);
+
+    if (x >= 0 && y >= 0 && x < canvas->PixelsWidth && y < canvas->PixelsHeight)
     {
-        if (x0 >= canvas->PixelsWidth || y0 >= canvas->PixelsHeight) break; // do not overflow buffer -- trim the line
+        setPixel(canvas, x, y);
+        BrailleCanvas_MarkPixels(canvas, x, y, x, y, 1);
+    }
+}
 
-        setPixel (x0,y0);
-        if (x0 == x1 && y0 == y1) break;
-        e2 = 2 * err;
-        if (e2 >= dy) { err += dy; x0 += sx; }
-        if (e2 <= dx) { err += dx; y0 += sy; }
+void BrailleCanvas_ClearPixel(BrailleCanvas* canvas, int32_t x, int32_t y)
+{
+    BrailleCanvas_Flush(canvas);
+
+    if (x >= 0 && y >= 0 && x < canvas->PixelsWidth && y < canvas->PixelsHeight)
+    {
+        clearPixel(canvas, x, y);
+        BrailleCanvas_MarkPixels(canvas, x, y, x, y, 0);
+    }
+}
+
+uint8_t BrailleCanvas_GetPixel(BrailleCanvas* canvas, int32_t x, int32_t y)
+{
+    BrailleCanvas_Flush(canvas);
+
+    if (x >= 0 && y >= 0 && x < canvas->PixelsWidth && y < canvas->PixelsHeight)
+        return getPixel(canvas, x, y);
+
+    return 0;
+}
+
+void BrailleCanvas_GetCharacter(BrailleCanvas* canvas, uint16_t row, uint16_t col, uint32_t * unicode)
+{
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED) // the cell already holds the braille pattern
+    {
+        *unicode = BRAILLE_UNICODE + canvas->PixelBuffer[col + (size_t)row*canvas->CharacterWidth];
+        return;
+    }
+
+    const uint8_t* pixels = canvas->PixelBuffer;
+    uint32_t x = col*BRAILLE_PIXELS_WIDTH;
+    uint32_t y = row*BRAILLE_PIXELS_HEIGHT;
+
+    #define pixelAt(x,y) (pixels[(x) + (size_t)(y)*canvas->PixelsWidth])
+
+    *unicode = BRAILLE_UNICODE;
+
+    // build the unicode code-point by matching the pixels in the block with the braille pattern
+    *unicode += UNICODE_BRAILLE_PATTERN[0][0]*pixelAt(x+0,y+0);  *unicode += UNICODE_BRAILLE_PATTERN[0][1]*pixelAt(x+1,y+0);
+    *unicode += UNICODE_BRAILLE_PATTERN[1][0]*pixelAt(x+0,y+1);  *unicode += UNICODE_BRAILLE_PATTERN[1][1]*pixelAt(x+1,y+1);
+    *unicode += UNICODE_BRAILLE_PATTERN[2][0]*pixelAt(x+0,y+2);  *unicode += UNICODE_BRAILLE_PATTERN[2][1]*pixelAt(x+1,y+2);
+    *unicode += UNICODE_BRAILLE_PATTERN[3][0]*pixelAt(x+0,y+3);  *unicode += UNICODE_BRAILLE_PATTERN[3][1]*pixelAt(x+1,y+3);
+
+    #undef pixelAt
+}
+
+// PACKING KERNELS
+// turn 2x4 pixel blocks (one byte per pixel, 0 or 1) into braille patterns
+// "pixels" points at the top-left pixel of the first cell and "stride" is the width of a pixel row
+//===========================================================================================
+typedef void (*BraillePackKernel)(const uint8_t* pixels, size_t stride, uint16_t count, uint8_t* patterns);
+
+static void BrailleCanvas_PackScalar(const uint8_t* pixels, size_t stride, uint16_t count, uint8_t* patterns)
+{
+    for (uint16_t i = 0; i < count; i++, pixels += BRAILLE_PIXELS_WIDTH)
+    {
+        uint8_t pattern = 0;
+        for (int y = 0; y < BRAILLE_PIXELS_HEIGHT; y++)
+            pattern |= UNICODE_BRAILLE_PATTERN[y][0]*pixels[y*stride] | UNICODE_BRAILLE_PATTERN[y][1]*pixels[y*stride + 1];
+
+        patterns[i] = pattern;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BRAILLE_PACK_SIMD
+
+// the pattern bit of every pixel column, for each of the four pixel rows (even columns are the left dot, odd the right)
+#define PACK_WEIGHTS(r) (char)UNICODE_BRAILLE_PATTERN[r][1], (char)UNICODE_BRAILLE_PATTERN[r][0]
+
+// 8 cells (16 pixels of each row) per step
+__attribute__((target("sse2")))
+static void BrailleCanvas_PackSSE2(const uint8_t* pixels, size_t stride, uint16_t count, uint8_t* patterns)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    __m128i weights[BRAILLE_PIXELS_HEIGHT];
+    for (int y = 0; y < BRAILLE_PIXELS_HEIGHT; y++)
+        weights[y] = _mm_set_epi8(PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y));
+
+    uint16_t i = 0;
+    for (; i + 8 <= count; i += 8, pixels += 16)
+    {
+        __m128i bits = zero;
+        for (int y = 0; y < BRAILLE_PIXELS_HEIGHT; y++)
+        {
+            __m128i row = _mm_loadu_si128((const __m128i*)(pixels + y*stride));
+            bits = _mm_or_si128(bits, _mm_andnot_si128(_mm_cmpeq_epi8(row, zero), weights[y])); // lit pixels keep their bit
+        }
+
+        // merge the left and right pixel of every cell, then narrow the 16-bit lanes to bytes
+        bits = _mm_and_si128(_mm_or_si128(bits, _mm_srli_epi16(bits, 8)), lowBytes);
+        _mm_storel_epi64((__m128i*)&patterns[i], _mm_packus_epi16(bits, bits));
+    }
+
+    BrailleCanvas_PackScalar(pixels, stride, count - i, &patterns[i]);
+}
+
+// 16 cells (32 pixels of each row) per step
+__attribute__((target("avx2")))
+static void BrailleCanvas_PackAVX2(const uint8_t* pixels, size_t stride, uint16_t count, uint8_t* patterns)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+    __m256i weights[BRAILLE_PIXELS_HEIGHT];
+    for (int y = 0; y < BRAILLE_PIXELS_HEIGHT; y++)
+        weights[y] = _mm256_set_epi8(PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y),
+                                     PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y), PACK_WEIGHTS(y));
+
+    uint16_t i = 0;
+    for (; i + 16 <= count; i += 16, pixels += 32)
+    {
+        __m256i bits = zero;
+        for (int y = 0; y < BRAILLE_PIXELS_HEIGHT; y++)
+        {
+            __m256i row = _mm256_loadu_si256((const __m256i*)(pixels + y*stride));
+            bits = _mm256_or_si256(bits, _mm256_andnot_si256(_mm256_cmpeq_epi8(row, zero), weights[y]));
+        }
+
+        bits = _mm256_and_si256(_mm256_or_si256(bits, _mm256_srli_epi16(bits, 8)), lowBytes);
+        bits = _mm256_packus_epi16(bits, bits); // packs inside each 128-bit lane ...
+        bits = _mm256_permute4x64_epi64(bits, 0xD8); // ... so gather the low quadword of both lanes
+        _mm_storeu_si128((__m128i*)&patterns[i], _mm256_castsi256_si128(bits));
     }
+
+    BrailleCanvas_PackSSE2(pixels, stride, count - i, &patterns[i]);
+}
+#endif
+
+static BraillePackKernel BrailleCanvas_PackKernel = NULL;
+static const char* BrailleCanvas_PackKernelName = NULL;
+
+// picks the fastest kernel the cpu supports, on first use
+static BraillePackKernel BrailleCanvas_SelectPackKernel()
+{
+    if (BrailleCanvas_PackKernel)
+        return BrailleCanvas_PackKernel;
+
+    BrailleCanvas_PackKernel = BrailleCanvas_PackScalar;
+    BrailleCanvas_PackKernelName = "scalar";
+
+    #ifdef BRAILLE_PACK_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        BrailleCanvas_PackKernel = BrailleCanvas_PackAVX2;
+        BrailleCanvas_PackKernelName = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        BrailleCanvas_PackKernel = BrailleCanvas_PackSSE2;
+        BrailleCanvas_PackKernelName = "sse2";
+    }
+    #endif
+
+    return BrailleCanvas_PackKernel;
+}
+
+// name of the packing kernel in use ("scalar", "sse2" or "avx2")
+const char* BrailleCanvas_GetPackKernel()
+{
+    BrailleCanvas_SelectPackKernel();
+    return BrailleCanvas_PackKernelName;
+}
+
+// computes the braille patterns (code-point minus BRAILLE_UNICODE) of "count" cells of a row, starting at column "col"
+void BrailleCanvas_PackRow(BrailleCanvas* canvas, uint16_t row, uint16_t col, uint16_t count, uint8_t* patterns)
+{
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED) // the cells already hold the patterns
+    {
+        memcpy(patterns, &canvas->PixelBuffer[col + (size_t)row*canvas->CharacterWidth], count);
+        return;
+    }
+
+    const uint8_t* pixels = &canvas->PixelBuffer[col*BRAILLE_PIXELS_WIDTH + (size_t)row*BRAILLE_PIXELS_HEIGHT*canvas->PixelsWidth];
+    BrailleCanvas_SelectPackKernel()(pixels, canvas->PixelsWidth, count, patterns);
+}
+
+// the reverse of BrailleCanvas_PackRow: replaces "count" cells of the row with braille patterns, and marks them changed
+void BrailleCanvas_UnpackRow(BrailleCanvas* canvas, uint16_t row, uint16_t col, uint16_t count, const uint8_t* patterns)
+{
+    BrailleCanvas_Flush(canvas); // queued calls come first
+
+    if (count == 0)
+        return;
+
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED)
+        memcpy(&canvas->PixelBuffer[col + (size_t)row*canvas->CharacterWidth], patterns, count);
+    else
+        for (int y = 0; y < BRAILLE_PIXELS_HEIGHT; y++)
+        {
+            uint8_t* pixels = &canvas->PixelBuffer[col*BRAILLE_PIXELS_WIDTH + (size_t)(row*BRAILLE_PIXELS_HEIGHT + y)*canvas->PixelsWidth];
+            for (uint16_t c = 0; c < count; c++)
+                for (int x = 0; x < BRAILLE_PIXELS_WIDTH; x++)
+                    pixels[c*BRAILLE_PIXELS_WIDTH + x] = (patterns[c] & UNICODE_BRAILLE_PATTERN[y][x]) != 0;
+        }
+
+    BrailleCanvas_MarkPixels(canvas, col*BRAILLE_PIXELS_WIDTH, row*BRAILLE_PIXELS_HEIGHT, (col + count)*BRAILLE_PIXELS_WIDTH - 1, (row + 1)*BRAILLE_PIXELS_HEIGHT - 1, 1);
+}
+//===========================================================================================
+
+// writes the utf-8 text of "count" braille patterns and returns the end of the text (not null-terminated)
+// blank braille symbols become an ascii empty space
+char* BrailleCanvas_EncodeRow(const uint8_t* patterns, uint16_t count, char* out)
+{
+    for (uint16_t i = 0; i < count; i++)
+    {
+        if (patterns[i])
+        {
+            memcpy(out, BRAILLE_UTF8_TABLE[patterns[i]], BRAILLE_UTF8_BYTES);
+            out += BRAILLE_UTF8_BYTES;
+        }
+        else
+            *out++ = ' ';
+    }
+
+    return out;
+}
+
+// null-terminated utf-8 text of a single braille pattern
+static void BrailleCanvas_EncodeCell(uint8_t pattern, char* utf8)
+{
+    *BrailleCanvas_EncodeRow(&pattern, 1, utf8) = 0;
+}
+
+// converts pixel groups to braille characters and prints them on screen, character by character
+void BrailleCanvas_Render_ByCallback(BrailleCanvas* canvas, void* object,void(*SetFunc)(uint8_t, uint8_t, uint8_t, uint8_t, char*, void*))
+{
+    BrailleCanvas_Flush(canvas);
+
+    // WARNING
+    // BACAUSE THIS FUNCTION IS INTENDED TO BE USED NESTED INSIDE ANOTHER RENDERING FUNCTION, IT WILL NOT CHANGE THE CURSOR POSTION OR THE CONSOLE STYLE
+    // the cells are those of the window, counted from its top-left corner
+    char utf8[5];
+    for (uint16_t row = 0; row < canvas->ViewHeight; row++)
+    {
+        for (uint16_t col = 0; col < canvas->ViewWidth; col++)
+        {
+            uint32_t unicode;
+            BrailleCanvas_GetCharacter(canvas, canvas->ViewRow + row, canvas->ViewColumn + col, &unicode);
+
+            if (unicode != BRAILLE_UNICODE)
+            {
+                BrailleCanvas_EncodeCell(unicode - BRAILLE_UNICODE, utf8);
+                SetFunc(col,row,canvas->ViewWidth,canvas->ViewHeight,utf8,object);
+            }
+        }
+    }
+}
+
+// like BrailleCanvas_Render_ByCallback, but only visits the cells changed since the last render
+// blank cells are reported as an ascii space, so the caller can erase what was there before
+void BrailleCanvas_Render_DirtyByCallback(BrailleCanvas* canvas, void* object,void(*SetFunc)(uint8_t, uint8_t, uint8_t, uint8_t, char*, void*))
+{
+    BrailleCanvas_Flush(canvas);
+
+    BrailleRect area = canvas->Dirty;
+    BrailleRect view = {canvas->ViewColumn, canvas->ViewRow, canvas->ViewColumn + canvas->ViewWidth, canvas->ViewRow + canvas->ViewHeight};
+    BrailleRect_Intersect(&area, &view);
+    char utf8[5];
+
+    for (uint16_t row = area.Top; row < area.Bottom; row++)
+    {
+        for (uint16_t col = area.Left; col < area.Right; col++)
+        {
+            uint32_t unicode;
+            BrailleCanvas_GetCharacter(canvas, row, col, &unicode);
+            BrailleCanvas_EncodeCell(unicode - BRAILLE_UNICODE, utf8); // blank cells become a space
+
+            SetFunc(col - view.Left,row - view.Top,canvas->ViewWidth,canvas->ViewHeight,utf8,object);
+        }
+    }
+
+    canvas->Dirty = EMPTY_RECT;
+}
+
+// like BrailleCanvas_Render_ByCallback, but one call per run of cells of a row: rows are packed in one go, and the callback gets the
+// patterns (and their utf-8 and colors) of the whole run - with BRAILLE_SPAN_CHANGED it is an incremental render, as BrailleCanvas_RenderDiff
+// AS THE OTHER CALLBACK RENDERERS, IT DOES NOT CHANGE THE CURSOR POSITION OR THE CONSOLE STYLE
+void BrailleCanvas_Render_SpansByCallback(BrailleCanvas* canvas, void* object, uint8_t flags, void(*SpanFunc)(const BrailleSpan*, void*))
+{
+    BrailleCanvas_Flush(canvas);
+
+    uint8_t changed = (flags & BRAILLE_SPAN_CHANGED) != 0;
+    uint8_t repaint = !canvas->FrontValid || canvas->FrontFillStyle != canvas->FillStyle || canvas->FrontBackgroundStyle != canvas->BackgroundStyle;
+
+    // the cells to look at, in cells of the window: the dirty ones for an incremental render
+    BrailleRect area = (BrailleRect){0, 0, canvas->ViewWidth, canvas->ViewHeight};
+    if (changed && !repaint)
+    {
+        BrailleRect view = {canvas->ViewColumn, canvas->ViewRow, canvas->ViewColumn + canvas->ViewWidth, canvas->ViewRow + canvas->ViewHeight};
+        BrailleRect dirty = canvas->Dirty;
+        BrailleRect_Intersect(&dirty, &view);
+
+        area = dirty.Right > dirty.Left ? (BrailleRect){dirty.Left - view.Left, dirty.Top - view.Top, dirty.Right - view.Left, dirty.Bottom - view.Top} : EMPTY_RECT;
+    }
+
+    uint8_t patterns[canvas->ViewWidth + 1]; // +1: never zero-length, for an empty view
+    char text[canvas->ViewWidth * BRAILLE_UTF8_BYTES + 1];
+
+    statsBegin(BRAILLE_STAGE_ENCODE);
+    for (uint16_t row = area.Top; row < area.Bottom; row++)
+    {
+        size_t surfaceRow = canvas->ViewColumn + (size_t)(canvas->ViewRow + row)*canvas->CharacterWidth;
+        uint8_t* front = &canvas->FrontBuffer[row * canvas->ViewWidth];
+        const BrailleCellStyle* styles = canvas->StylePlane ? &canvas->StylePlane[surfaceRow] : NULL;
+        BrailleCellStyle* frontStyles = canvas->StylePlane ? &canvas->FrontStyles[row * canvas->ViewWidth] : NULL;
+        uint16_t known = row < canvas->FrontHeight ? canvas->FrontWidth : 0;
+
+        // a cell is handed over when it is not blank, or, for an incremental render, when its pattern or its colors changed
+        #define cellWanted(c) (changed ? (repaint || c >= known || patterns[c] != front[c] || (styles && !sameStyle(styles[c], frontStyles[c]))) : patterns[c] != 0)
+
+        BrailleCanvas_PackRow(canvas, canvas->ViewRow + row, canvas->ViewColumn + area.Left, area.Right - area.Left, &patterns[area.Left]);
+
+        uint16_t col = area.Left;
+        while (col < area.Right)
+        {
+            if (!cellWanted(col))
+            {
+                col++;
+                continue;
+            }
+
+            uint16_t end = col + 1;
+            while (end < area.Right && cellWanted(end))
+                end++;
+
+            BrailleSpan span = {row, col, end - col, &patterns[col], NULL, 0, styles ? &styles[col] : NULL};
+            if (flags & BRAILLE_SPAN_UTF8)
+            {
+                span.Text = text;
+                span.TextLength = BrailleCanvas_EncodeRow(&patterns[col], end - col, text) - text;
+            }
+
+            SpanFunc(&span, object);
+            statsAdd(CellsEncoded, end - col);
+
+            if (changed)
+            {
+                memcpy(&front[col], &patterns[col], end - col);
+                if (styles)
+                    memcpy(&frontStyles[col], &styles[col], (end - col) * sizeof(BrailleCellStyle));
+            }
+
+            col = end;
+        }
+
+        #undef cellWanted
+    }
+
+    statsEnd(BRAILLE_STAGE_ENCODE);
+
+    if (changed)
+    {
+        canvas->FrontValid = 1;
+        canvas->FrontWidth = canvas->ViewWidth;
+        canvas->FrontHeight = canvas->ViewHeight;
+        canvas->FrontFillStyle = canvas->FillStyle;
+        canvas->FrontBackgroundStyle = canvas->BackgroundStyle;
+        canvas->Dirty = EMPTY_RECT;
+    }
+}
+
+// sets the terminal to the style of a cell: the canvas style first, then the cell colors on top of it
+static int BrailleCanvas_ApplyStyle(BrailleCanvas* canvas, BrailleCellStyle style)
+{
+    return Terminal_SetStyle(canvas->FillStyle, canvas->BackgroundStyle) + Terminal_SetColor(style.Foreground, style.Background);
+}
+
+// prints the cells start...end-1 of a row of the window - the cursor must already be at "start" and the terminal in the style "current"
+// the style is only switched where it changes from one cell to the next, and the printed cells are copied to the front buffer
+static int BrailleCanvas_WriteCells(BrailleCanvas* canvas, uint16_t row, uint16_t start, uint16_t end, const uint8_t* patterns, BrailleCellStyle* current, char* buffer)
+{
+    int bytes = 0;
+    size_t offset = row * canvas->ViewWidth;
+
+    memcpy(&canvas->FrontBuffer[offset + start], &patterns[start], end - start);
+    statsAdd(CellsEncoded, end - start);
+
+    if (!canvas->StylePlane) // a single style for the whole canvas
+    {
+        char* text = BrailleCanvas_EncodeRow(&patterns[start], end - start, buffer);
+        return Terminal_Write(buffer, text - buffer);
+    }
+
+    const BrailleCellStyle* styles = &canvas->StylePlane[canvas->ViewColumn + (size_t)(canvas->ViewRow + row)*canvas->CharacterWidth];
+    memcpy(&canvas->FrontStyles[offset + start], &styles[start], (end - start) * sizeof(BrailleCellStyle));
+
+    uint16_t col = start;
+    while (col < end)
+    {
+        uint16_t run = col + 1; // cells that share the style
+        while (run < end && sameStyle(styles[run], styles[col]))
+            run++;
+
+        if (!sameStyle(styles[col], *current))
+        {
+            bytes += BrailleCanvas_ApplyStyle(canvas, styles[col]);
+            *current = styles[col];
+        }
+
+        char* text = BrailleCanvas_EncodeRow(&patterns[col], run - col, buffer);
+        bytes += Terminal_Write(buffer, text - buffer);
+
+        col = run;
+    }
+
+    return bytes;
+}
+
+// converts pixel groups to braille characters and prints them on screen, row by row
+void BrailleCanvas_Render(BrailleCanvas* canvas)
+{
+    BrailleCanvas_Flush(canvas); // rasterize the queued drawing calls first
+
+    if (!Terminal_Ready()) // a non-blocking terminal is still busy: the next incremental render repaints everything instead
+    {
+        Terminal_DropFrame();
+        canvas->FrontValid = 0;
+        return;
+    }
+
+    statsBegin(BRAILLE_STAGE_ENCODE);
+    Terminal_BeginFrame(); // the whole canvas goes out to the terminal in a single write
+
+    Terminal_SaveCursorPosition(); // let's save the current state before we do anything
+
+    Terminal_SetStyle(canvas->FillStyle, canvas->BackgroundStyle); // set the style
+    Terminal_ClearArea(canvas->CharacterLeft, canvas->CharacterTop, canvas->ViewWidth, canvas->ViewHeight); // erase previous render
+
+    BrailleCellStyle current = DEFAULT_CELL_STYLE; // the terminal is in the canvas style
+    uint8_t patterns[canvas->ViewWidth + 1]; // +1: never zero-length, for an empty view
+    char print_line_buffer[canvas->ViewWidth * BRAILLE_UTF8_BYTES + 1]; // buffer an entire row - it's faster than printing one character at a time
+
+    for (uint16_t row = 0; row < canvas->ViewHeight; row++) // iterate over the rows of the window and print along the lines (natural printing left to right)
+    {
+        BrailleCanvas_PackRow(canvas, canvas->ViewRow + row, canvas->ViewColumn, canvas->ViewWidth, patterns);
+
+        Terminal_SetCursorPosition(canvas->CharacterLeft, canvas->CharacterTop + row); // move to the correct row
+        BrailleCanvas_WriteCells(canvas, row, 0, canvas->ViewWidth, patterns, &current, print_line_buffer);
+    }
+
+    Terminal_RestoreCursorSavedPosition(); // move the cursor back to where it was before
+    statsEnd(BRAILLE_STAGE_ENCODE);
+
+    statsBegin(BRAILLE_STAGE_WRITE);
+    int sent = Terminal_EndFrame();
+    statsEnd(BRAILLE_STAGE_WRITE);
+
+    canvas->FrontValid = sent >= 0; // a frame lost on the way leaves the screen unknown: the next render repaints it
+    canvas->FrontWidth = canvas->ViewWidth;
+    canvas->FrontHeight = canvas->ViewHeight;
+    canvas->FrontFillStyle = canvas->FillStyle;
+    canvas->FrontBackgroundStyle = canvas->BackgroundStyle;
+    canvas->Dirty = EMPTY_RECT;
+}
+
+// unchanged cells shorter than this are reprinted instead of jumping over them with the cursor
+#define RENDER_DIFF_MIN_GAP 4
+
+// converts pixel groups to braille characters and prints only the runs of cells that differ from the previous render
+void BrailleCanvas_RenderDiff(BrailleCanvas* canvas, BrailleRenderStats* stats)
+{
+    BrailleCanvas_Flush(canvas); // rasterize the queued drawing calls first
+
+    // a non-blocking terminal still busy with an earlier frame drops this one: the dirty region and the front buffer are kept,
+    // so the next frame that goes out carries every change since the last one printed, instead of queuing behind it
+    if (!Terminal_Ready())
+    {
+        Terminal_DropFrame();
+        if (stats)
+            *stats = (BrailleRenderStats){0, 0, 1};
+
+        return;
+    }
+
+    uint32_t cells = 0;
+    uint32_t bytes = 0;
+
+    // a style change affects every cell, and an invalid front buffer means we don't know what is on screen
+    uint8_t repaint = !canvas->FrontValid || canvas->FrontFillStyle != canvas->FillStyle || canvas->FrontBackgroundStyle != canvas->BackgroundStyle;
+    uint8_t started = 0;
+    BrailleCellStyle current = DEFAULT_CELL_STYLE;
+
+    // outside the dirty region the front buffer already matches the pixels - the area is in cells of the window
+    BrailleRect area = (BrailleRect){0, 0, canvas->ViewWidth, canvas->ViewHeight};
+    if (!repaint)
+    {
+        BrailleRect view = {canvas->ViewColumn, canvas->ViewRow, canvas->ViewColumn + canvas->ViewWidth, canvas->ViewRow + canvas->ViewHeight};
+        BrailleRect dirty = canvas->Dirty;
+        BrailleRect_Intersect(&dirty, &view);
+
+        area = dirty.Right > dirty.Left ? (BrailleRect){dirty.Left - view.Left, dirty.Top - view.Top, dirty.Right - view.Left, dirty.Bottom - view.Top} : EMPTY_RECT;
+    }
+
+    uint8_t patterns[canvas->ViewWidth + 1]; // the new frame, one row at a time (+1: never zero-length, for an empty view)
+    char print_line_buffer[canvas->ViewWidth * BRAILLE_UTF8_BYTES + 1]; // worst case: every cell is a braille character
+
+    statsBegin(BRAILLE_STAGE_ENCODE);
+    Terminal_BeginFrame(); // all the changed runs go out to the terminal in a single write
+
+    for (uint16_t row = area.Top; row < area.Bottom; row++)
+    {
+        size_t surfaceRow = canvas->ViewColumn + (size_t)(canvas->ViewRow + row)*canvas->CharacterWidth;
+        const uint8_t* front = &canvas->FrontBuffer[row * canvas->ViewWidth];
+        const BrailleCellStyle* styles = canvas->StylePlane ? &canvas->StylePlane[surfaceRow] : NULL;
+        const BrailleCellStyle* frontStyles = canvas->StylePlane ? &canvas->FrontStyles[row * canvas->ViewWidth] : NULL;
+
+        // cells exposed by a resize were never printed
+        uint16_t known = row < canvas->FrontHeight ? canvas->FrontWidth : 0;
+
+        // a cell must be printed again when its pattern or its colors changed
+        #define cellChanged(c) (repaint || c >= known || patterns[c] != front[c] || (styles && !sameStyle(styles[c], frontStyles[c])))
+
+        BrailleCanvas_PackRow(canvas, canvas->ViewRow + row, canvas->ViewColumn + area.Left, area.Right - area.Left, &patterns[area.Left]);
+
+        uint16_t col = area.Left;
+        while (col < area.Right)
+        {
+            // skip the cells that are already on screen
+            if (!cellChanged(col))
+            {
+                col++;
+                continue;
+            }
+
+            // find where the run ends: it absorbs short gaps of unchanged cells, cheaper to reprint than to jump
+            uint16_t start = col;
+            uint16_t end = col + 1;
+            uint16_t gap = 0;
+            for (uint16_t next = end; next < area.Right && gap < RENDER_DIFF_MIN_GAP; next++)
+            {
+                if (cellChanged(next))
+                {
+                    end = next + 1;
+                    gap = 0;
+                }
+                else
+                    gap++;
+            }
+
+            if (!started) // only touch the terminal state if there is anything to print
+            {
+                bytes += Terminal_SaveCursorPosition();
+                bytes += Terminal_SetStyle(canvas->FillStyle, canvas->BackgroundStyle);
+                started = 1;
+            }
+
+            bytes += Terminal_SetCursorPosition(canvas->CharacterLeft + start, canvas->CharacterTop + row);
+            bytes += BrailleCanvas_WriteCells(canvas, row, start, end, patterns, &current, print_line_buffer);
+
+            cells += end - start;
+            col = end;
+        }
+
+        #undef cellChanged
+    }
+
+    if (started)
+        bytes += Terminal_RestoreCursorSavedPosition();
+    statsEnd(BRAILLE_STAGE_ENCODE);
+
+    statsBegin(BRAILLE_STAGE_WRITE);
+    int sent = Terminal_EndFrame();
+    statsEnd(BRAILLE_STAGE_WRITE);
+
+    canvas->FrontValid = sent >= 0; // a frame lost on the way leaves the screen unknown: the next render repaints it
+    canvas->FrontWidth = canvas->ViewWidth;
+    canvas->FrontHeight = canvas->ViewHeight;
+    canvas->FrontFillStyle = canvas->FillStyle;
+    canvas->FrontBackgroundStyle = canvas->BackgroundStyle;
+    canvas->Dirty = EMPTY_RECT;
+
+    if (stats)
+        *stats = sent >= 0 ? (BrailleRenderStats){cells, bytes, 0} : (BrailleRenderStats){0, 0, 1};
+}
+
+// packed storage: bits of the left and right pixel columns of a cell, for the pixel rows first...last inside the cell
+static uint8_t packedColumnMask(uint8_t column, int first, int last)
+{
+    uint8_t mask = 0;
+    for (int y = first; y <= last; y++)
+        mask |= UNICODE_BRAILLE_PATTERN[y][column];
+
+    return mask;
+}
+
+// sets every pixel in the inclusive box (x0,y0)-(x1,y1) - the box is clipped to the clip rectangle
+// returns the number of pixels set
+static uint64_t BrailleCanvas_FillBox(BrailleCanvas* canvas, int x0, int y0, int x1, int y1)
+{
+    x0 = max(x0, canvas->Clip.Left*BRAILLE_PIXELS_WIDTH);
+    y0 = max(y0, canvas->Clip.Top*BRAILLE_PIXELS_HEIGHT);
+    x1 = min(x1, canvas->Clip.Right*BRAILLE_PIXELS_WIDTH - 1);
+    y1 = min(y1, canvas->Clip.Bottom*BRAILLE_PIXELS_HEIGHT - 1);
+
+    if (x1 < x0 || y1 < y0)
+        return 0;
+
+    BrailleCanvas_MarkPixels(canvas, x0, y0, x1, y1, 1);
+
+    uint64_t area = (uint64_t)(x1 - x0 + 1) * (y1 - y0 + 1);
+
+    if (canvas->StylePlane)
+        for (int row = y0 / BRAILLE_PIXELS_HEIGHT; row <= y1 / BRAILLE_PIXELS_HEIGHT; row++)
+            for (int col = x0 / BRAILLE_PIXELS_WIDTH; col <= x1 / BRAILLE_PIXELS_WIDTH; col++)
+                canvas->StylePlane[col + (size_t)row*canvas->CharacterWidth] = canvas->Pen;
+
+    if (canvas->Storage != BRAILLE_STORAGE_PACKED)
+    {
+        for (int y = y0; y <= y1; y++)
+            memset(&canvas->PixelBuffer[x0 + (size_t)y*canvas->PixelsWidth], 1, x1 - x0 + 1);
+
+        return area;
+    }
+
+    // packed: each row of cells gets the same masks - partial cells at the borders, both columns in between
+    int firstCol = x0 / BRAILLE_PIXELS_WIDTH;
+    int lastCol = x1 / BRAILLE_PIXELS_WIDTH;
+
+    for (int row = y0 / BRAILLE_PIXELS_HEIGHT; row <= y1 / BRAILLE_PIXELS_HEIGHT; row++)
+    {
+        int first = max(y0 - row*BRAILLE_PIXELS_HEIGHT, 0);
+        int last = min(y1 - row*BRAILLE_PIXELS_HEIGHT, BRAILLE_PIXELS_HEIGHT - 1);
+
+        uint8_t left = packedColumnMask(0, first, last);
+        uint8_t right = packedColumnMask(1, first, last);
+        uint8_t both = left | right;
+
+        uint8_t* cells = &canvas->PixelBuffer[(size_t)row*canvas->CharacterWidth];
+
+        if (firstCol == lastCol)
+        {
+            cells[firstCol] |= (x0 % BRAILLE_PIXELS_WIDTH ? 0 : left) | (x1 % BRAILLE_PIXELS_WIDTH ? right : 0);
+            continue;
+        }
+
+        cells[firstCol] |= x0 % BRAILLE_PIXELS_WIDTH ? right : both;
+        for (int col = firstCol + 1; col < lastCol; col++)
+            cells[col] |= both;
+        cells[lastCol] |= x1 % BRAILLE_PIXELS_WIDTH ? both : left;
+    }
+
+    return area;
+}
+
+// sets the pixels x0...x1 (inclusive) of the row y - the span is clipped to the clip rectangle
+static uint64_t BrailleCanvas_FillSpan(BrailleCanvas* canvas, int x0, int x1, int y)
+{
+    return BrailleCanvas_FillBox(canvas, x0, y, x1, y);
+}
+
+void BrailleCanvas_FillRectangle(BrailleCanvas* canvas, int32_t X, int32_t Y, int32_t W, int32_t H)
+{
+    if (BrailleCanvas_Defer(canvas, BRAILLE_COMMAND_FILL_RECTANGLE, X, Y, W, H))
+        return;
+
+    if (W <= 0 || H <= 0)
+        return;
+
+    statsBegin(BRAILLE_STAGE_RASTER);
+    uint64_t written = BrailleCanvas_FillBox(canvas, X, Y, min((int64_t)X + W - 1, INT32_MAX), min((int64_t)Y + H - 1, INT32_MAX));
+    statsAdd(PixelsWritten[BRAILLE_COMMAND_FILL_RECTANGLE], written);
+    statsEnd(BRAILLE_STAGE_RASTER);
+}
+
+void BrailleCanvas_StrokeRectangle(BrailleCanvas* canvas, int32_t X, int32_t Y, int32_t W, int32_t H)
+{
+    BrailleCanvas_StrokeLine(canvas, X, Y, X, Y+H); // left side
+    BrailleCanvas_StrokeLine(canvas, X+W, Y, X+W, Y+H); // right side
+    BrailleCanvas_StrokeLine(canvas, X, Y, X+W, Y); // top side
+    BrailleCanvas_StrokeLine(canvas, X, Y+H, X+W, Y+H); // bottom side
+}
+
+// sets the pixels x0...x1 (inclusive) of the row y, for spans that may reach far beyond the canvas - clipped to the clip rectangle
+static uint64_t BrailleCanvas_FillSpanWide(BrailleCanvas* canvas, int64_t x0, int64_t x1, int64_t y)
+{
+    const int64_t left = canvas->Clip.Left*BRAILLE_PIXELS_WIDTH, right = canvas->Clip.Right*BRAILLE_PIXELS_WIDTH - 1;
+    const int64_t top = canvas->Clip.Top*BRAILLE_PIXELS_HEIGHT, bottom = canvas->Clip.Bottom*BRAILLE_PIXELS_HEIGHT - 1;
+    if (x1 < left || x0 > right || x1 < x0 || y < top || y > bottom)
+        return 0;
+
+    return BrailleCanvas_FillSpan(canvas, (int)max(x0, left), (int)min(x1, right), (int)y);
+}
+
+// Bresenham's circle, one row at a time
+// the walk (x = 0, y = r, f = 1 - r) keeps y while x*x + y*(y-1) < r*r and steps it down otherwise, so the y it has at x is the
+// largest one passing that test - except the last point, one step past the octant - and each row can be found on its own:
+// only the rows inside the clip rectangle are computed (all in 64 bits: r*r fits for any 32-bit radius)
+//===========================================================================================
+typedef struct
+{
+    int64_t R;
+    int64_t Last; // x of the last point of the walk
+    int64_t LastY; // and its y
+} BrailleCircle;
+
+static int64_t BrailleCircle_Sqrt(int64_t value) // floor of the square root, -1 for negative values
+{
+    if (value < 0)
+        return -1;
+
+    int64_t root = (int64_t)sqrt((double)value);
+    while (root * root > value)
+        root--;
+    while ((root + 1) * (root + 1) <= value)
+        root++;
+
+    return root;
+}
+
+// y of the walk at 0 <= x < Last: the largest y with x*x + y*(y-1) < r*r
+static int64_t BrailleCircle_Y(const BrailleCircle* circle, int64_t x)
+{
+    int64_t d = circle->R * circle->R - x * x;
+    if (d <= 0)
+        return -1;
+
+    int64_t y = BrailleCircle_Sqrt(d) + 1;
+    while (y * (y - 1) >= d)
+        y--;
+
+    return y;
+}
+
+static void BrailleCircle_Create(BrailleCircle* circle, int64_t r)
+{
+    circle->R = r;
+    circle->Last = 0;
+    circle->LastY = r;
+    if (r <= 0)
+        return;
+
+    // the walk stops at the first x not below its y: the last x inside the octant is found by bisection
+    int64_t low = 0, high = r;
+    while (low < high)
+    {
+        int64_t middle = low + (high - low + 1) / 2;
+        if (middle < BrailleCircle_Y(circle, middle))
+            low = middle;
+        else
+            high = middle - 1;
+    }
+
+    // the last step goes past the octant, keeping y or stepping it down once
+    int64_t y = BrailleCircle_Y(circle, low);
+    circle->Last = low + 1;
+    circle->LastY = circle->Last * circle->Last + y * (y - 1) < r * r ? y : y - 1;
+}
+
+static int64_t BrailleCircle_At(const BrailleCircle* circle, int64_t x)
+{
+    return x == 0 ? circle->R : x == circle->Last ? circle->LastY : BrailleCircle_Y(circle, x);
+}
+
+// the points of the walk on the row "k" below the center: x in [*low, *high] (empty when low > high), and the mirrored point at
+// x = *mirror (-1: none) - the other octants follow by symmetry
+static void BrailleCircle_Row(const BrailleCircle* circle, int64_t k, int64_t* low, int64_t* high, int64_t* mirror)
+{
+    int64_t r = circle->R;
+
+    // y(x) >= k for x <= Sqrt(r*r - k*k + k - 1), while inside the octant
+    *low = BrailleCircle_Sqrt(r * r - (k + 1) * (k + 1) + k) + 1;
+    *high = min(BrailleCircle_Sqrt(r * r - k * k + k - 1), circle->Last - 1);
+
+    if (circle->LastY == k)
+        *high = circle->Last;
+    if (*high < *low && circle->LastY == k)
+        *low = circle->Last;
+
+    *mirror = k <= circle->Last ? BrailleCircle_At(circle, k) : -1;
+}
+
+// the rows of a circle much larger than the clip rectangle, which are the only ones computed
+// returns the number of pixels set
+static uint64_t BrailleCanvas_CircleRows(BrailleCanvas* canvas, int64_t x0, int64_t y0, int64_t r, uint8_t fillOrStroke,
+                                         int64_t top, int64_t bottom)
+{
+    BrailleCircle circle;
+    BrailleCircle_Create(&circle, r);
+
+    // the rows below the center (k = 0...r), then those above it
+    const int64_t first[2] = {max(top - y0, 0), max(y0 - bottom, 1)};
+    const int64_t last[2] = {min(bottom - y0, r), min(y0 - top, r)};
+
+    uint64_t written = 0;
+    for (int half = 0; half < 2; half++)
+        for (int64_t k = first[half]; k <= last[half]; k++)
+        {
+            int64_t y = half ? y0 - k : y0 + k;
+            int64_t low, high, mirror;
+            BrailleCircle_Row(&circle, k, &low, &high, &mirror);
+
+            if (fillOrStroke) // one span to the widest point
+            {
+                int64_t halfWidth = max(high, mirror);
+                if (halfWidth >= 0)
+                    written += BrailleCanvas_FillSpanWide(canvas, x0 - halfWidth, x0 + halfWidth, y);
+                continue;
+            }
+
+            if (low <= high)
+            {
+                written += BrailleCanvas_FillSpanWide(canvas, x0 + low, x0 + high, y);
+                written += BrailleCanvas_FillSpanWide(canvas, x0 - high, x0 - low, y);
+            }
+
+            if (mirror >= 0)
+            {
+                written += BrailleCanvas_FillSpanWide(canvas, x0 + mirror, x0 + mirror, y);
+                written += BrailleCanvas_FillSpanWide(canvas, x0 - mirror, x0 - mirror, y);
+            }
+        }
+
+    return written;
+}
+//===========================================================================================
+
+// fills the disc of the Bresenham circle with one span per row
+// the half-width of each row (0...r below the center, mirrored above) is the widest octant point on that row
+// r is at most about the size of the clip rectangle (see BrailleCanvas_BresenhamCircle), so the half-widths fit in an int
+// returns the number of pixels set
+static uint64_t BrailleCanvas_FillDisc(BrailleCanvas* canvas, int64_t x0, int64_t y0, int r, int64_t top, int64_t bottom)
+{
+    int* halfWidth = (int*)malloc((r + 1) * sizeof(int));
+    if (!halfWidth)
+        return 0;
+
+    int64_t f = 1 - r;
+    int64_t ddF_x = 1;
+    int64_t ddF_y = -2 * (int64_t)r;
+    int x = 0;
+    int y = r;
+
+    halfWidth[0] = r;
+    for (int row = 1; row <= r; row++)
+        halfWidth[row] = -1;
+
+    while (x < y)
+    {
+        if (f >= 0)
+        {
+          y--;
+          ddF_y += 2;
+          f += ddF_y;
+        }
+
+        x++;
+        ddF_x += 2;
+        f += ddF_x;
+
+        halfWidth[y] = max(halfWidth[y], x);
+        halfWidth[x] = max(halfWidth[x], y);
+    }
+
+    // only the rows inside the clip rectangle
+    uint64_t written = 0;
+    for (int64_t row = max(top - y0, 0); row <= min(bottom - y0, r); row++)
+        if (halfWidth[row] >= 0)
+            written += BrailleCanvas_FillSpanWide(canvas, x0 - halfWidth[row], x0 + halfWidth[row], y0 + row);
+
+    for (int64_t row = max(y0 - bottom, 1); row <= min(y0 - top, r); row++)
+        if (halfWidth[row] >= 0)
+            written += BrailleCanvas_FillSpanWide(canvas, x0 - halfWidth[row], x0 + halfWidth[row], y0 - row);
+
+    free(halfWidth);
+    return written;
+}
+
+// Bresenham's circle algorithm
+// the error terms are 64-bit, as the coordinates of the points: any 32-bit radius and center work
+void BrailleCanvas_BresenhamCircle(BrailleCanvas* canvas, int32_t x0, int32_t y0, int32_t r, uint8_t fillOrStroke)
+{
+    if (BrailleCanvas_Defer(canvas, fillOrStroke ? BRAILLE_COMMAND_FILL_CIRCLE : BRAILLE_COMMAND_STROKE_CIRCLE, x0, y0, r, 0))
+        return;
+
+    if (r < 0)
+        return;
+
+    // nothing to do when the box of the circle misses the clip rectangle
+    const int64_t left = canvas->Clip.Left*BRAILLE_PIXELS_WIDTH, right = canvas->Clip.Right*BRAILLE_PIXELS_WIDTH - 1;
+    const int64_t top = canvas->Clip.Top*BRAILLE_PIXELS_HEIGHT, bottom = canvas->Clip.Bottom*BRAILLE_PIXELS_HEIGHT - 1;
+    if ((int64_t)x0 + r < left || (int64_t)x0 - r > right || (int64_t)y0 + r < top || (int64_t)y0 - r > bottom)
+        return;
+
+    statsBegin(BRAILLE_STAGE_RASTER);
+
+    // the walk covers the whole circle: beyond the size of the clip rectangle, only its rows inside it are computed
+    if ((int64_t)r > (right - left + 1) + (bottom - top + 1))
+    {
+        uint64_t written = BrailleCanvas_CircleRows(canvas, x0, y0, r, fillOrStroke, top, bottom);
+        statsAdd(PixelsWritten[fillOrStroke ? BRAILLE_COMMAND_FILL_CIRCLE : BRAILLE_COMMAND_STROKE_CIRCLE], written);
+        statsEnd(BRAILLE_STAGE_RASTER);
+        return;
+    }
+
+    if (fillOrStroke)
+    {
+        uint64_t written = BrailleCanvas_FillDisc(canvas, x0, y0, r, top, bottom);
+        statsAdd(PixelsWritten[BRAILLE_COMMAND_FILL_CIRCLE], written);
+        statsEnd(BRAILLE_STAGE_RASTER);
+        return;
+    }
+
+    // the circle is at most about the size of the clip rectangle here: its points fit in an int
+    BrailleCanvas_MarkPixels(canvas, max(x0 - (int64_t)r, left), max(y0 - (int64_t)r, top), min(x0 + (int64_t)r, right), min(y0 + (int64_t)r, bottom), 1);
+
+    int64_t f = 1 - (int64_t)r;
+    int64_t ddF_x = 1;
+    int64_t ddF_y = -2 * (int64_t)r;
+    int x = 0;
+    int y = r;
+
+    uint32_t written = 0;
+    written += safeSetPixel(canvas, x0, y0 + r);
+    written += safeSetPixel(canvas, x0, y0 - r);
+    written += safeSetPixel(canvas, x0 + r, y0);
+    written += safeSetPixel(canvas, x0 - r, y0);
+
+    while (x < y)
+    {
+        if (f >= 0)
+        {
+          y--;
+          ddF_y += 2;
+          f += ddF_y;
+        }
+
+        x++;
+        ddF_x += 2;
+        f += ddF_x;
+
+        written += safeSetPixel(canvas, x0 + x, y0 + y);
+        written += safeSetPixel(canvas, x0 - x, y0 + y);
+
+        written += safeSetPixel(canvas, x0 + x, y0 - y);
+        written += safeSetPixel(canvas, x0 - x, y0 - y);
+
+        written += safeSetPixel(canvas, x0 + y, y0 + x);
+        written += safeSetPixel(canvas, x0 - y, y0 + x);
+
+        written += safeSetPixel(canvas, x0 + y, y0 - x);
+        written += safeSetPixel(canvas, x0 - y, y0 - x);
+    }
+
+    statsAdd(PixelsWritten[BRAILLE_COMMAND_STROKE_CIRCLE], written);
+    statsEnd(BRAILLE_STAGE_RASTER);
+}
+
+void BrailleCanvas_FillCircle(BrailleCanvas* canvas, int32_t X, int32_t Y, int32_t R) { BrailleCanvas_BresenhamCircle(canvas, X, Y, R, 1); }
+void BrailleCanvas_StrokeCircle(BrailleCanvas* canvas, int32_t X, int32_t Y, int32_t R) { BrailleCanvas_BresenhamCircle(canvas, X, Y, R, 0); }
+
+// Bresenham's line algorithm, clipped before it is walked
+// the walk steps the major axis every time, and after i steps the minor axis has stepped floor((2*minor*i + major) / (2*major)) times,
+// so it can start and stop anywhere: the pixels are exactly those of the whole walk, and lines cut by tiles join without seams
+//===========================================================================================
+// minor axis steps done after "i" major steps (the distances are below 2^32, so minor*i fits in 64 bits)
+static inline int64_t BrailleLine_MinorSteps(uint64_t major, uint64_t minor, uint64_t i)
+{
+    uint64_t p = minor * i;
+    return (int64_t)(p / major + (2 * (p % major) >= major));
+}
+
+// first major step at which the minor axis has stepped "k" times or more - major+1 if never
+static int64_t BrailleLine_FirstStep(uint64_t major, uint64_t minor, int64_t k)
+{
+    if (k <= 0)
+        return 0;
+
+    if (k > (int64_t)minor)
+        return (int64_t)major + 1;
+
+    // solves 2*minor*i >= (2k-1)*major: doubles are exact for any line near the canvas, and the estimate is fixed up for the others
+    int64_t i = (int64_t)((2.0 * k - 1) * major / (2.0 * minor));
+    i = min(max(i, 0), (int64_t)major);
+
+    while (i < (int64_t)major && BrailleLine_MinorSteps(major, minor, i) < k)
+        i++;
+
+    while (i > 0 && BrailleLine_MinorSteps(major, minor, i - 1) >= k)
+        i--;
+
+    return i;
+}
+
+// draws the part of the line inside the clip rectangle, without its first pixel if "skipFirst" - returns the number of pixels written
+static uint32_t BrailleCanvas_ClippedLine(BrailleCanvas* canvas, int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint8_t skipFirst)
+{
+    const int64_t left = canvas->Clip.Left*BRAILLE_PIXELS_WIDTH, right = canvas->Clip.Right*BRAILLE_PIXELS_WIDTH - 1;
+    const int64_t top = canvas->Clip.Top*BRAILLE_PIXELS_HEIGHT, bottom = canvas->Clip.Bottom*BRAILLE_PIXELS_HEIGHT - 1;
+
+    // nothing to do for lines that never cross the clip rectangle
+    if (max(x0, x1) < left || min(x0, x1) > right || max(y0, y1) < top || min(y0, y1) > bottom)
+        return 0;
+
+    // 64 bits: the distances between two 32-bit coordinates don't fit in 32 bits
+    int64_t dx = llabs((int64_t)x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int64_t dy = llabs((int64_t)y1 - y0), sy = y0 < y1 ? 1 : -1;
+
+    // "a" is the major axis and "b" the minor one (x on diagonals)
+    uint8_t xMajor = dx >= dy;
+    int64_t major = xMajor ? dx : dy, minor = xMajor ? dy : dx;
+    int64_t a0 = xMajor ? x0 : y0, sa = xMajor ? sx : sy, aMin = xMajor ? left : top, aMax = xMajor ? right : bottom;
+    int64_t b0 = xMajor ? y0 : x0, sb = xMajor ? sy : sx, bMin = xMajor ? top : left, bMax = xMajor ? bottom : right;
+
+    // steps inside the clip rectangle: from the major axis directly, from the minor axis through the steps it needs to enter and leave
+    int64_t first = sa > 0 ? aMin - a0 : a0 - aMax;
+    int64_t last = sa > 0 ? aMax - a0 : a0 - aMin;
+    int64_t enter = BrailleLine_FirstStep(major, minor, sb > 0 ? bMin - b0 : b0 - bMax);
+    int64_t leave = BrailleLine_FirstStep(major, minor, (sb > 0 ? bMax - b0 : b0 - bMin) + 1) - 1;
+
+    first = max(max(first, enter), (int64_t)skipFirst);
+    last = min(min(last, leave), major);
+    if (last < first)
+        return 0;
+
+    // state of the walk after "first" steps - the error terms may wrap around, their sum does not
+    uint64_t k = major ? (uint64_t)BrailleLine_MinorSteps(major, minor, first) : 0;
+    uint64_t xSteps = xMajor ? (uint64_t)first : k, ySteps = xMajor ? k : (uint64_t)first;
+    int64_t err = (int64_t)((uint64_t)dx - (uint64_t)dy - xSteps * (uint64_t)dy + ySteps * (uint64_t)dx), e2;
+    int64_t x = x0 + sx * (int64_t)xSteps;
+    int64_t y = y0 + sy * (int64_t)ySteps;
+    int64_t startX = x, startY = y;
+
+    for (int64_t i = first; ; i++)
+    {
+        setPixel(canvas, (uint32_t)x, (uint32_t)y);
+        if (i == last) break;
+        e2 = 2 * err;
+        if (e2 >= -dy) { err -= dy; x += sx; }
+        if (e2 <= dx) { err += dx; y += sy; }
+    }
+
+    BrailleCanvas_MarkPixels(canvas, min(startX, x), min(startY, y), max(startX, x), max(startY, y), 1);
+    return (uint32_t)(last - first + 1);
+}
+
+void BrailleCanvas_StrokeLine(BrailleCanvas* canvas, int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    if (BrailleCanvas_Defer(canvas, BRAILLE_COMMAND_LINE, x0, y0, x1, y1))
+        return;
+
+    statsBegin(BRAILLE_STAGE_RASTER);
+    uint32_t written = BrailleCanvas_ClippedLine(canvas, x0, y0, x1, y1, 0);
+    statsAdd(PixelsWritten[BRAILLE_COMMAND_LINE], written);
+    statsEnd(BRAILLE_STAGE_RASTER);
+}
+
+// lines joining consecutive points - each vertex shared by two lines is drawn once
+void BrailleCanvas_StrokePolyline(BrailleCanvas* canvas, const BraillePoint* points, uint32_t count)
+{
+    if (count == 0)
+        return;
+
+    if (canvas->Recording || canvas->Workers) // queued as separate lines
+    {
+        for (uint32_t i = (count > 1); i < count; i++)
+            BrailleCanvas_StrokeLine(canvas, points[i ? i-1 : 0].X, points[i ? i-1 : 0].Y, points[i].X, points[i].Y);
+
+        return;
+    }
+
+    statsBegin(BRAILLE_STAGE_RASTER);
+    uint32_t written = 0;
+
+    if (count == 1)
+        written = BrailleCanvas_ClippedLine(canvas, points[0].X, points[0].Y, points[0].X, points[0].Y, 0);
+
+    for (uint32_t i = 1; i < count; i++)
+        written += BrailleCanvas_ClippedLine(canvas, points[i-1].X, points[i-1].Y, points[i].X, points[i].Y, i > 1);
+
+    statsAdd(PixelsWritten[BRAILLE_COMMAND_LINE], written);
+    statsEnd(BRAILLE_STAGE_RASTER);
+}
+
+// POLYGONS, ELLIPSES AND ARCS
+// all filled with spans: time proportional to the rows and the cells covered, not to the perimeter drawn as lines
+//===========================================================================================
+// an edge of a polygon, for the active edge table
+typedef struct
+{
+    int32_t Top; // the pixel rows whose centers the edge crosses: Top <= y < Bottom
+    int32_t Bottom;
+    int64_t X0; // the upper end
+    int64_t Y0;
+    int64_t DX; // to the lower end - DY > 0
+    int64_t DY;
+    int8_t Winding; // +1 going down, -1 going up
+    double X; // where the edge crosses the center of the current row
+} BraillePolygonEdge;
+
+static int BraillePolygonEdge_CompareTop(const void* a, const void* b)
+{
+    int32_t ta = ((const BraillePolygonEdge*)a)->Top;
+    int32_t tb = ((const BraillePolygonEdge*)b)->Top;
+    return (ta > tb) - (ta < tb);
+}
+
+// sets the pixels x0...x1 of the row y, with x0 and x1 clamped to the clip rectangle first
+static uint64_t BrailleCanvas_FillSpanClamped(BrailleCanvas* canvas, double x0, double x1, int y)
+{
+    double left = canvas->Clip.Left*BRAILLE_PIXELS_WIDTH;
+    double right = canvas->Clip.Right*BRAILLE_PIXELS_WIDTH - 1;
+    if (x1 < left || x0 > right || x1 < x0)
+        return 0;
+
+    return BrailleCanvas_FillSpan(canvas, (int)max(x0, left), (int)min(x1, right), y);
+}
+
+// scanline fill with an active edge table: a pixel is inside when its center is
+// the edges are sorted by their top row once, and each row only updates and re-sorts the edges it crosses
+// returns the number of pixels set
+static uint64_t BrailleCanvas_ScanPolygon(BrailleCanvas* canvas, const BraillePoint* points, uint32_t count, BrailleFillRule rule)
+{
+    BraillePolygonEdge* edges = (BraillePolygonEdge*)malloc(count * sizeof(BraillePolygonEdge));
+    BraillePolygonEdge** active = (BraillePolygonEdge**)malloc(count * sizeof(BraillePolygonEdge*));
+    if (!edges || !active)
+    {
+        free(edges);
+        free(active);
+        return 0;
+    }
+
+    // the edge table: horizontal edges never cross a row center
+    uint32_t edgeCount = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const BraillePoint* a = &points[i];
+        const BraillePoint* b = &points[(i + 1) % count];
+        if (a->Y == b->Y)
+            continue;
+
+        BraillePolygonEdge* edge = &edges[edgeCount++];
+        const BraillePoint* top = a->Y < b->Y ? a : b;
+        const BraillePoint* bottom = a->Y < b->Y ? b : a;
+
+        edge->Top = top->Y;
+        edge->Bottom = bottom->Y;
+        edge->X0 = top->X;
+        edge->Y0 = top->Y;
+        edge->DX = (int64_t)bottom->X - top->X;
+        edge->DY = (int64_t)bottom->Y - top->Y;
+        edge->Winding = a->Y < b->Y ? 1 : -1;
+    }
+
+    qsort(edges, edgeCount, sizeof(BraillePolygonEdge), BraillePolygonEdge_CompareTop);
+
+    int32_t firstRow = canvas->Clip.Top*BRAILLE_PIXELS_HEIGHT;
+    int32_t lastRow = canvas->Clip.Bottom*BRAILLE_PIXELS_HEIGHT - 1;
+    if (edgeCount)
+        firstRow = max(firstRow, edges[0].Top);
+
+    uint64_t written = 0;
+    uint32_t next = 0; // the first edge of the table not yet active
+    uint32_t activeCount = 0;
+
+    for (int32_t y = firstRow; y <= lastRow; y++)
+    {
+        // edges ending above this row leave, edges starting on it join
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < activeCount; i++)
+            if (active[i]->Bottom > y)
+                active[kept++] = active[i];
+
+        activeCount = kept;
+
+        for (; next < edgeCount && edges[next].Top <= y; next++)
+            if (edges[next].Bottom > y)
+                active[activeCount++] = &edges[next];
+
+        if (activeCount == 0)
+        {
+            if (next == edgeCount)
+                break; // no edge below
+
+            y = min(edges[next].Top, lastRow + 1) - 1; // skip the rows no edge crosses
+            continue;
+        }
+
+        // crossings with the row center, sorted left to right - insertion sort, as the order barely changes from row to row
+        for (uint32_t i = 0; i < activeCount; i++)
+        {
+            BraillePolygonEdge* edge = active[i];
+            edge->X = edge->X0 + (double)edge->DX * (double)(2*(int64_t)y + 1 - 2*edge->Y0) / (double)(2*edge->DY);
+
+            for (uint32_t j = i; j > 0 && active[j-1]->X > edge->X; j--)
+            {
+                active[j] = active[j-1];
+                active[j-1] = edge;
+            }
+        }
+
+        // the pixels whose centers lie between two crossings: ceil(left - 0.5) ... ceil(right - 0.5) - 1
+        #define fillBetween(left, right) written += BrailleCanvas_FillSpanClamped(canvas, ceil((left) - 0.5), ceil((right) - 0.5) - 1, y)
+
+        if (rule == BRAILLE_FILL_EVEN_ODD)
+        {
+            for (uint32_t i = 0; i + 1 < activeCount; i += 2)
+                fillBetween(active[i]->X, active[i+1]->X);
+        }
+        else
+        {
+            int32_t winding = 0;
+            double left = 0;
+            for (uint32_t i = 0; i < activeCount; i++)
+            {
+                int32_t previous = winding;
+                winding += active[i]->Winding;
+
+                if (previous == 0 && winding != 0)
+                    left = active[i]->X;
+                else if (previous != 0 && winding == 0)
+                    fillBetween(left, active[i]->X);
+            }
+        }
+
+        #undef fillBetween
+    }
+
+    free(edges);
+    free(active);
+    return written;
+}
+
+// fills the inside of the closed polygon through the points (the last one joins the first)
+// a pixel is inside when its center is: shapes sharing an edge don't overlap and leave no gap between them
+void BrailleCanvas_FillPolygon(BrailleCanvas* canvas, const BraillePoint* points, uint32_t count, BrailleFillRule rule)
+{
+    if (count < 3 || count > (UINT32_MAX - 4) / 2)
+        return;
+
+    if (canvas->Recording || canvas->Workers) // queued with the bounding box and the points as data
+    {
+        int32_t* data = (int32_t*)malloc((4 + 2 * (size_t)count) * sizeof(int32_t));
+        if (!data)
+            return;
+
+        data[0] = data[2] = points[0].X;
+        data[1] = data[3] = points[0].Y;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            data[0] = min(data[0], points[i].X);
+            data[1] = min(data[1], points[i].Y);
+            data[2] = max(data[2], points[i].X);
+            data[3] = max(data[3], points[i].Y);
+            data[4 + 2*i] = points[i].X;
+            data[5 + 2*i] = points[i].Y;
+        }
+
+        BrailleCanvas_DeferData(canvas, BRAILLE_COMMAND_FILL_POLYGON, count, rule, 0, 0, data, 4 + 2*count);
+        free(data);
+        return;
+    }
+
+    statsBegin(BRAILLE_STAGE_RASTER);
+    uint64_t written = BrailleCanvas_ScanPolygon(canvas, points, count, rule);
+    statsAdd(PixelsWritten[BRAILLE_COMMAND_FILL_POLYGON], written);
+    statsEnd(BRAILLE_STAGE_RASTER);
+}
+
+// draws a queued polygon: the points are in the data commands after the bounding box
+static void BrailleCanvas_ExecutePolygon(BrailleCanvas* canvas, const BrailleDrawCommand* command)
+{
+    uint32_t count = command->Args[0];
+    BraillePoint* points = (BraillePoint*)malloc(count * sizeof(BraillePoint));
+    if (!points)
+        return;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t word = 4 + 2*i;
+        points[i].X = command[1 + word / 4].Args[word % 4];
+        points[i].Y = command[1 + (word + 1) / 4].Args[(word + 1) % 4];
+    }
+
+    BrailleCanvas_FillPolygon(canvas, points, count, (BrailleFillRule)command->Args[1]);
+    free(points);
+}
+
+// the angles an arc covers: a pixel at (dx, dy) from the center is on the arc when it is on the inner side of both
+// the start ray S and the end ray T - or of either one, for arcs longer than half a turn
+typedef struct
+{
+    uint8_t Full;
+    uint8_t Wide; // more than half a turn
+    double Sx, Sy; // unit vectors, y pointing up
+    double Tx, Ty;
+} BrailleArcSector;
+
+// unit vector at an angle in 64ths of a degree - exact on the axes, so quarter arcs end exactly on them
+static void BrailleArcSector_Direction(int64_t angle, double* x, double* y)
+{
+    static const int8_t axes[4][2] = { {1, 0}, {0, 1}, {-1, 0}, {0, -1} };
+
+    angle %= 360*64;
+    if (angle < 0)
+        angle += 360*64;
+
+    if (angle % (90*64) == 0)
+    {
+        *x = axes[angle / (90*64)][0];
+        *y = axes[angle / (90*64)][1];
+        return;
+    }
+
+    double radians = angle * (BRAILLE_PI / (180*64));
+    *x = cos(radians);
+    *y = sin(radians);
+}
+
+static void BrailleArcSector_Create(BrailleArcSector* sector, int64_t start, int64_t extent)
+{
+    if (extent < 0) // clockwise: the same arc, counterclockwise from its other end
+    {
+        start += extent;
+        extent = -extent;
+    }
+
+    sector->Full = extent >= 360*64;
+    sector->Wide = extent > 180*64;
+    BrailleArcSector_Direction(start, &sector->Sx, &sector->Sy);
+    BrailleArcSector_Direction(start + extent, &sector->Tx, &sector->Ty);
+}
+
+// the offsets dx with a*dx <= b
+static void BrailleArcSector_HalfLine(double a, double b, int64_t* low, int64_t* high)
+{
+    const double far = 1e12; // beyond any canvas
+    *low = -(int64_t)far;
+    *high = (int64_t)far;
+
+    if (a == 0)
+    {
+        if (b < 0) // none
+            *low = *high + 1;
+    }
+    else if (a > 0)
+        *high = (int64_t)floor(max(min(b / a, far), -far));
+    else
+        *low = (int64_t)ceil(max(min(b / a, far), -far));
+}
+
+// sets the pixels between dx = x0 and x1 (from the center) of the row dy that are on the arc
+// returns the number of pixels set
+static uint64_t BrailleCanvas_ArcSpan(BrailleCanvas* canvas, const BrailleArcSector* sector, int32_t cx, int32_t cy, int64_t x0, int64_t x1, int64_t dy)
+{
+    #define fillOffsets(a, b) BrailleCanvas_FillSpanClamped(canvas, (double)cx + (a), (double)cx + (b), (int)max(min(cy + dy, INT32_MAX), INT32_MIN))
+
+    if (sector->Full)
+        return fillOffsets(x0, x1);
+
+    // with y pointing up, p = (dx, -dy) is inside the start ray when cross(S, p) >= 0 and inside the end ray when cross(p, T) >= 0
+    int64_t low1, high1, low2, high2;
+    BrailleArcSector_HalfLine(sector->Sy, -sector->Sx * dy, &low1, &high1);
+    BrailleArcSector_HalfLine(-sector->Ty, sector->Tx * dy, &low2, &high2);
+
+    low1 = max(low1, x0); high1 = min(high1, x1);
+    low2 = max(low2, x0); high2 = min(high2, x1);
+
+    if (!sector->Wide) // both
+        return fillOffsets(max(low1, low2), min(high1, high2));
+
+    // either: two pieces of the row, or one when they meet
+    if (low1 > high1)
+        return fillOffsets(low2, high2);
+
+    if (low2 > high2)
+        return fillOffsets(low1, high1);
+
+    if (low1 <= high2 + 1 && low2 <= high1 + 1)
+        return fillOffsets(min(low1, low2), max(high1, high2));
+
+    return fillOffsets(low1, high1) + fillOffsets(low2, high2);
+
+    #undef fillOffsets
+}
+
+// midpoint ellipse algorithm, walking a quarter of the outline once
+// the result is the widest outline point of each row (0...ry below the center, mirrored above): the fill is a span per row,
+// and the outline of a row runs from just past the outline of the row below it out to that widest point
+// only the rows inside the clip rectangle are kept, and radii above BRAILLE_ELLIPSE_WALK_RADIUS are not walked:
+// the decision terms reach 4*rx²*ry², so those rows are taken from the ellipse equation instead
+static void BrailleCanvas_MidpointEllipse(BrailleCanvas* canvas, int32_t x0, int32_t y0, int32_t rx, int32_t ry, int32_t start, int32_t extent, uint8_t fillOrStroke)
+{
+    BrailleCommandType type = fillOrStroke ? BRAILLE_COMMAND_FILL_ARC : BRAILLE_COMMAND_STROKE_ARC;
+    int32_t angles[2] = {start, extent};
+    if (BrailleCanvas_DeferData(canvas, type, x0, y0, rx, ry, angles, 2))
+        return;
+
+    if (rx < 0 || ry < 0 || extent == 0)
+        return;
+
+    // nothing to do when the box of the ellipse misses the clip rectangle
+    const int64_t left = canvas->Clip.Left*BRAILLE_PIXELS_WIDTH, right = canvas->Clip.Right*BRAILLE_PIXELS_WIDTH - 1;
+    const int64_t top = canvas->Clip.Top*BRAILLE_PIXELS_HEIGHT, bottom = canvas->Clip.Bottom*BRAILLE_PIXELS_HEIGHT - 1;
+    if ((int64_t)x0 + rx < left || (int64_t)x0 - rx > right || (int64_t)y0 + ry < top || (int64_t)y0 - ry > bottom)
+        return;
+
+    // the rows first...last (from the center) reach the clip rectangle below or above the center, and the stroke needs the row after
+    const int64_t first = y0 > bottom ? y0 - bottom : (y0 < top ? top - y0 : 0);
+    const int64_t last = min(max(bottom - y0, y0 - top), (int64_t)ry);
+    int64_t* halfWidth = (int64_t*)malloc((size_t)(last - first + 2) * sizeof(int64_t));
+    if (!halfWidth)
+        return;
+
+    statsBegin(BRAILLE_STAGE_RASTER);
+
+    BrailleArcSector sector;
+    BrailleArcSector_Create(&sector, start, extent);
+
+    for (int64_t row = first; row <= last + 1; row++)
+        halfWidth[row - first] = -1;
+
+    if (rx <= BRAILLE_ELLIPSE_WALK_RADIUS && ry <= BRAILLE_ELLIPSE_WALK_RADIUS)
+    {
+        #define widen(row, x) if ((row) >= first && (row) <= last + 1) halfWidth[(row) - first] = max(halfWidth[(row) - first], x)
+
+        // the decision variables are scaled by 4 to stay integers
+        const int64_t a2 = (int64_t)rx * rx;
+        const int64_t b2 = (int64_t)ry * ry;
+        int64_t x = 0;
+        int64_t y = ry;
+        int64_t dx = 0; // 2*b2*x
+        int64_t dy = 2 * a2 * y; // 2*a2*y
+
+        // region 1: the outline is flatter than 45 degrees, x steps every time
+        int64_t d = 4*b2 - 4*a2*ry + a2;
+        while (dx < dy && y >= first)
+        {
+            widen(y, x);
+
+            x++;
+            dx += 2*b2;
+            if (d < 0)
+                d += 4*(dx + b2);
+            else
+            {
+                y--;
+                dy -= 2*a2;
+                d += 4*(dx - dy + b2);
+            }
+        }
+
+        // region 2: steeper, y steps every time
+        d = b2*(2*x + 1)*(2*x + 1) + 4*a2*(y - 1)*(y - 1) - 4*a2*b2;
+        while (y >= first)
+        {
+            widen(y, x);
+
+            y--;
+            dy -= 2*a2;
+            if (d > 0)
+                d += 4*(a2 - dy);
+            else
+            {
+                x++;
+                dx += 2*b2;
+                d += 4*(dx - dy + a2);
+            }
+        }
+
+        #undef widen
+    }
+    else
+    {
+        // as the walk: where the outline is flat, a row runs out to where it crosses row - 1/2, and where it is steep,
+        // the point of the row is the one nearest to the ellipse - with X(y) = rx*sqrt(ry² - y²)/ry, the wider of the two
+        for (int64_t row = max(first, 1); row <= min(last + 1, (int64_t)ry); row++)
+        {
+            double flat = floor(rx * sqrt((double)(2*(ry - row) + 1) * (double)(2*(ry + row) - 1)) / (2.0*ry));
+            double steep = floor(rx * sqrt((double)((ry - row) * (ry + row))) / ry + 0.5);
+            halfWidth[row - first] = (int64_t)max(flat, steep);
+        }
+
+        if (first == 0)
+            halfWidth[0] = rx;
+    }
+
+    if (ry == 0) // a flat ellipse is a line
+        halfWidth[0] = rx;
+
+    uint64_t written = 0;
+    for (int64_t row = first; row <= last; row++)
+    {
+        const uint8_t below = y0 + row >= top && y0 + row <= bottom;
+        const uint8_t above = row && y0 - row >= top && y0 - row <= bottom;
+        int64_t outer = halfWidth[row - first];
+        if (fillOrStroke)
+        {
+            if (below)
+                written += BrailleCanvas_ArcSpan(canvas, &sector, x0, y0, -outer, outer, row);
+            if (above)
+                written += BrailleCanvas_ArcSpan(canvas, &sector, x0, y0, -outer, outer, -row);
+
+            continue;
+        }
+
+        int64_t inner = min(halfWidth[row - first + 1] + 1, outer); // at least one pixel per row
+
+        if (below)
+        {
+            written += BrailleCanvas_ArcSpan(canvas, &sector, x0, y0, inner, outer, row);
+            written += BrailleCanvas_ArcSpan(canvas, &sector, x0, y0, -outer, -max(inner, 1), row);
+        }
+        if (above)
+        {
+            written += BrailleCanvas_ArcSpan(canvas, &sector, x0, y0, inner, outer, -row);
+            written += BrailleCanvas_ArcSpan(canvas, &sector, x0, y0, -outer, -max(inner, 1), -row);
+        }
+    }
+
+    free(halfWidth);
+
+    statsAdd(PixelsWritten[type], written);
+    statsEnd(BRAILLE_STAGE_RASTER);
+}
+
+void BrailleCanvas_FillEllipse(BrailleCanvas* canvas, int32_t X, int32_t Y, int32_t RX, int32_t RY) { BrailleCanvas_MidpointEllipse(canvas, X, Y, RX, RY, 0, 360*64, 1); }
+void BrailleCanvas_StrokeEllipse(BrailleCanvas* canvas, int32_t X, int32_t Y, int32_t RX, int32_t RY) { BrailleCanvas_MidpointEllipse(canvas, X, Y, RX, RY, 0, 360*64, 0); }
+
+// a pie slice: the part of the ellipse between the rays at the start and start + extent angles
+void BrailleCanvas_FillArc(BrailleCanvas* canvas, int32_t X, int32_t Y, int32_t RX, int32_t RY, int32_t start, int32_t extent) { BrailleCanvas_MidpointEllipse(canvas, X, Y, RX, RY, start, extent, 1); }
+void BrailleCanvas_StrokeArc(BrailleCanvas* canvas, int32_t X, int32_t Y, int32_t RX, int32_t RY, int32_t start, int32_t extent) { BrailleCanvas_MidpointEllipse(canvas, X, Y, RX, RY, start, extent, 0); }
+//===========================================================================================
+
+
+// DEFERRED TILE RENDERING
+// drawing calls are queued, binned into tiles of whole cells, and each tile is rasterized by one worker
+// with the clip rectangle set to the tile - no two workers ever write the same cell, and inside a tile
+// the calls run in the order they were made, so the result is the same as drawing immediately
+//===========================================================================================
+// primitives crossing several tiles are walked once per tile, so tiles are kept large:
+// about TILES_PER_WORKER tiles per worker, enough to balance the load
+#define TILES_PER_WORKER 4
+
+struct BrailleWorkerPool
+{
+    pthread_t* Threads;
+    uint8_t Count;
+
+    pthread_mutex_t Lock;
+    pthread_cond_t Wake;
+    pthread_cond_t Done;
+    uint32_t Generation; // bumped for every job
+    uint8_t Quit;
+
+    // the job: rasterize every tile of the canvas
+    BrailleCanvas* Canvas;
+    uint16_t TileWidth; // cells
+    uint16_t TileHeight; // cells
+    uint16_t TilesAcross;
+    uint32_t TileCount;
+    const uint32_t* BinStart; // commands of tile t are Bins[BinStart[t]] ... Bins[BinStart[t+1]-1]
+    const uint32_t* Bins;
+    uint32_t NextTile;
+    uint8_t Busy;
+
+    // what the workers touched
+    BrailleRect Dirty;
+    BrailleRect Ink;
+};
+
+// not a drawing call: four more arguments of the drawing command before it (polygons and arcs don't fit in one command)
+#define BRAILLE_COMMAND_DATA BRAILLE_COMMAND_COUNT
+
+// makes room for more commands in a growable array of commands
+static uint8_t BrailleCommands_Reserve(BrailleDrawCommand** commands, uint32_t count, uint32_t* capacity, uint32_t more)
+{
+    if (count + more > *capacity)
+    {
+        uint32_t grownCapacity = max(max(2 * *capacity, 64), count + more);
+        BrailleDrawCommand* grown = (BrailleDrawCommand*)realloc(*commands, grownCapacity * sizeof(BrailleDrawCommand));
+        if (!grown)
+            return 0;
+
+        *commands = grown;
+        *capacity = grownCapacity;
+    }
+
+    return 1;
+}
+
+// appends a command, and the data commands holding its extra arguments, to a growable array of commands
+static uint8_t BrailleCommands_Append(BrailleDrawCommand** commands, uint32_t* count, uint32_t* capacity, BrailleCommandType type, int32_t a, int32_t b, int32_t c, int32_t d, BrailleCellStyle pen, const int32_t* data, uint32_t words)
+{
+    uint32_t dataCommands = (words + 3) / 4;
+    if (!BrailleCommands_Reserve(commands, *count, capacity, 1 + dataCommands))
+        return 0;
+
+    BrailleDrawCommand* command = &(*commands)[(*count)++];
+    command->Type = type;
+    command->Args[0] = a;
+    command->Args[1] = b;
+    command->Args[2] = c;
+    command->Args[3] = d;
+    command->Pen = pen;
+
+    for (uint32_t i = 0; i < words; i++)
+    {
+        if (i % 4 == 0)
+        {
+            command = &(*commands)[(*count)++];
+            command->Type = BRAILLE_COMMAND_DATA;
+            memset(command->Args, 0, sizeof(command->Args));
+            command->Pen = pen;
+        }
+
+        command->Args[i % 4] = data[i];
+    }
+
+    return 1;
+}
+
+// records the drawing call (and its extra arguments) in the display list being recorded, or queues it for the workers
+// returns 0 if the call must be drawn right away
+static uint8_t BrailleCanvas_DeferData(BrailleCanvas* canvas, BrailleCommandType type, int32_t a, int32_t b, int32_t c, int32_t d, const int32_t* data, uint32_t words)
+{
+    if (canvas->Recording)
+    {
+        BrailleDisplayList* list = canvas->Recording;
+        if (BrailleCommands_Append(&list->Commands, &list->CommandCount, &list->CommandCapacity, type, a, b, c, d, canvas->Pen, data, words))
+            list->Version++;
+
+        return 1;
+    }
+
+    if (canvas->Workers)
+    {
+        BrailleCommands_Append(&canvas->Commands, &canvas->CommandCount, &canvas->CommandCapacity, type, a, b, c, d, canvas->Pen, data, words);
+        return 1;
+    }
+
+    return 0;
+}
+
+// records the drawing call in the display list being recorded, or queues it for the workers
+// returns 0 if the call must be drawn right away
+static uint8_t BrailleCanvas_Defer(BrailleCanvas* canvas, BrailleCommandType type, int32_t a, int32_t b, int32_t c, int32_t d)
+{
+    return BrailleCanvas_DeferData(canvas, type, a, b, c, d, NULL, 0);
+}
+
+// inclusive pixel box that a command may touch
+static void BrailleCanvas_CommandBounds(const BrailleDrawCommand* command, int64_t* x0, int64_t* y0, int64_t* x1, int64_t* y1)
+{
+    const int32_t* a = command->Args;
+    switch (command->Type)
+    {
+        case BRAILLE_COMMAND_LINE:
+            *x0 = min(a[0], a[2]); *y0 = min(a[1], a[3]);
+            *x1 = max(a[0], a[2]); *y1 = max(a[1], a[3]);
+            break;
+
+        case BRAILLE_COMMAND_FILL_RECTANGLE:
+            *x0 = a[0]; *y0 = a[1];
+            *x1 = (int64_t)a[0] + a[2] - 1; *y1 = (int64_t)a[1] + a[3] - 1;
+            break;
+
+        case BRAILLE_COMMAND_FILL_POLYGON: // the bounding box is the first data command
+            *x0 = command[1].Args[0]; *y0 = command[1].Args[1];
+            *x1 = command[1].Args[2]; *y1 = command[1].Args[3];
+            break;
+
+        case BRAILLE_COMMAND_STROKE_ARC:
+        case BRAILLE_COMMAND_FILL_ARC:
+            *x0 = (int64_t)a[0] - a[2]; *y0 = (int64_t)a[1] - a[3];
+            *x1 = (int64_t)a[0] + a[2]; *y1 = (int64_t)a[1] + a[3];
+            break;
+
+        case BRAILLE_COMMAND_DATA: // nothing to draw
+            *x0 = *y0 = 0;
+            *x1 = *y1 = -1;
+            break;
+
+        default: // circles
+            *x0 = (int64_t)a[0] - a[2]; *y0 = (int64_t)a[1] - a[2];
+            *x1 = (int64_t)a[0] + a[2]; *y1 = (int64_t)a[1] + a[2];
+            break;
+    }
+}
+
+// draws a command right away (on a canvas with no workers)
+static void BrailleCanvas_Execute(BrailleCanvas* canvas, const BrailleDrawCommand* command)
+{
+    const int32_t* a = command->Args;
+    canvas->Pen = command->Pen;
+
+    switch (command->Type)
+    {
+        case BRAILLE_COMMAND_LINE: BrailleCanvas_StrokeLine(canvas, a[0], a[1], a[2], a[3]); break;
+        case BRAILLE_COMMAND_FILL_RECTANGLE: BrailleCanvas_FillRectangle(canvas, a[0], a[1], a[2], a[3]); break;
+        case BRAILLE_COMMAND_STROKE_CIRCLE: BrailleCanvas_BresenhamCircle(canvas, a[0], a[1], a[2], 0); break;
+        case BRAILLE_COMMAND_FILL_CIRCLE: BrailleCanvas_BresenhamCircle(canvas, a[0], a[1], a[2], 1); break;
+        case BRAILLE_COMMAND_FILL_POLYGON: BrailleCanvas_ExecutePolygon(canvas, command); break;
+        case BRAILLE_COMMAND_STROKE_ARC: BrailleCanvas_MidpointEllipse(canvas, a[0], a[1], a[2], a[3], command[1].Args[0], command[1].Args[1], 0); break;
+        case BRAILLE_COMMAND_FILL_ARC: BrailleCanvas_MidpointEllipse(canvas, a[0], a[1], a[2], a[3], command[1].Args[0], command[1].Args[1], 1); break;
+        default: break; // data commands are read by the command before them
+    }
+}
+
+static void* BrailleCanvas_Worker(void* arg)
+{
+    BrailleWorkerPool* pool = (BrailleWorkerPool*)arg;
+    uint32_t generation = 0;
+
+    pthread_mutex_lock(&pool->Lock);
+    for (;;)
+    {
+        while (pool->Generation == generation && !pool->Quit)
+            pthread_cond_wait(&pool->Wake, &pool->Lock);
+
+        if (pool->Quit)
+            break;
+
+        generation = pool->Generation;
+        pthread_mutex_unlock(&pool->Lock);
+
+        // a private view of the canvas: same buffers, own clip rectangle and dirty tracking
+        BrailleCanvas view = *pool->Canvas;
+        view.Workers = NULL; // draw immediately
+        view.Recording = NULL;
+        view.Dirty = EMPTY_RECT;
+        view.Ink = EMPTY_RECT;
+
+        // private counters too: only the pixel counts are kept, the time is taken by BrailleCanvas_Flush
+        #ifdef BRAILLE_CANVAS_STATS
+        BrailleFrameStats stats;
+        memset(&stats, 0, sizeof(stats));
+        view.Stats = view.Stats ? &stats : NULL;
+        #endif
+
+        for (;;)
+        {
+            uint32_t tile = __sync_fetch_and_add(&pool->NextTile, 1);
+            if (tile >= pool->TileCount)
+                break;
+
+            // the tile, inside the clip rectangle of the canvas
+            uint16_t left = (tile % pool->TilesAcross) * pool->TileWidth;
+            uint16_t top = (tile / pool->TilesAcross) * pool->TileHeight;
+            view.Clip.Left = max(left, pool->Canvas->Clip.Left);
+            view.Clip.Top = max(top, pool->Canvas->Clip.Top);
+            view.Clip.Right = min(left + pool->TileWidth, pool->Canvas->Clip.Right);
+            view.Clip.Bottom = min(top + pool->TileHeight, pool->Canvas->Clip.Bottom);
+
+            for (uint32_t i = pool->BinStart[tile]; i < pool->BinStart[tile + 1]; i++)
+                BrailleCanvas_Execute(&view, &pool->Canvas->Commands[pool->Bins[i]]);
+        }
+
+        pthread_mutex_lock(&pool->Lock);
+        BrailleRect_Union(&pool->Dirty, &view.Dirty);
+        BrailleRect_Union(&pool->Ink, &view.Ink);
+
+        #ifdef BRAILLE_CANVAS_STATS
+        if (view.Stats)
+            for (int type = 0; type < BRAILLE_COMMAND_COUNT; type++)
+                pool->Canvas->Stats->PixelsWritten[type] += stats.PixelsWritten[type];
+        #endif
+
+        if (--pool->Busy == 0)
+            pthread_cond_signal(&pool->Done);
+    }
+    pthread_mutex_unlock(&pool->Lock);
+
+    return NULL;
+}
+
+// with more than one thread, drawing calls are queued and rasterized in parallel by BrailleCanvas_Flush
+// (the renderers flush on their own) - 0 or 1 thread goes back to drawing immediately
+void BrailleCanvas_SetThreads(BrailleCanvas* canvas, uint8_t threads)
+{
+    BrailleCanvas_Flush(canvas);
+
+    BrailleWorkerPool* pool = canvas->Workers;
+    if (pool) // stop the current pool
+    {
+        pthread_mutex_lock(&pool->Lock);
+        pool->Quit = 1;
+        pthread_cond_broadcast(&pool->Wake);
+        pthread_mutex_unlock(&pool->Lock);
+
+        for (uint8_t i = 0; i < pool->Count; i++)
+            pthread_join(pool->Threads[i], NULL);
+
+        pthread_mutex_destroy(&pool->Lock);
+        pthread_cond_destroy(&pool->Wake);
+        pthread_cond_destroy(&pool->Done);
+        free(pool->Threads);
+        free(pool);
+        canvas->Workers = NULL;
+    }
+
+    if (threads <= 1)
+        return;
+
+    pool = (BrailleWorkerPool*)calloc(1, sizeof(BrailleWorkerPool));
+    pool->Threads = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    pthread_mutex_init(&pool->Lock, NULL);
+    pthread_cond_init(&pool->Wake, NULL);
+    pthread_cond_init(&pool->Done, NULL);
+
+    for (pool->Count = 0; pool->Count < threads; pool->Count++)
+        if (pthread_create(&pool->Threads[pool->Count], NULL, BrailleCanvas_Worker, pool) != 0)
+            break;
+
+    if (pool->Count == 0) // no threads, no deferred rendering
+    {
+        fprintf(stderr, "\nCanvas worker threads could not be created\n");
+        pthread_mutex_destroy(&pool->Lock);
+        pthread_cond_destroy(&pool->Wake);
+        pthread_cond_destroy(&pool->Done);
+        free(pool->Threads);
+        free(pool);
+        return;
+    }
+
+    canvas->Workers = pool;
+}
+
+// rasterizes the queued drawing calls
+void BrailleCanvas_Flush(BrailleCanvas* canvas)
+{
+    BrailleWorkerPool* pool = canvas->Workers;
+    if (!pool || canvas->CommandCount == 0)
+        return;
+
+    statsBegin(BRAILLE_STAGE_RASTER);
+
+    // a square grid of about TILES_PER_WORKER tiles per worker
+    uint16_t grid = 1;
+    while (grid * grid < TILES_PER_WORKER * pool->Count)
+        grid++;
+
+    uint16_t tileWidth = max((canvas->CharacterWidth + grid - 1) / grid, 1);
+    uint16_t tileHeight = max((canvas->CharacterHeight + grid - 1) / grid, 1);
+    uint16_t tilesAcross = (canvas->CharacterWidth + tileWidth - 1) / tileWidth;
+    uint16_t tilesDown = (canvas->CharacterHeight + tileHeight - 1) / tileHeight;
+    uint32_t tileCount = (uint32_t)tilesAcross * tilesDown;
+
+    // tile range touched by each command, or an empty range if the command is entirely off-canvas
+    #define commandTiles(command) \
+        int64_t x0, y0, x1, y1; \
+        BrailleCanvas_CommandBounds(command, &x0, &y0, &x1, &y1); \
+        x0 = max(x0, 0); y0 = max(y0, 0); \
+        x1 = min(x1, (int64_t)canvas->PixelsWidth - 1); y1 = min(y1, (int64_t)canvas->PixelsHeight - 1); \
+        int tileLeft = (int)(x0 / (tileWidth*BRAILLE_PIXELS_WIDTH)), tileRight = x1 < x0 ? tileLeft - 1 : (int)(x1 / (tileWidth*BRAILLE_PIXELS_WIDTH)); \
+        int tileTop = (int)(y0 / (tileHeight*BRAILLE_PIXELS_HEIGHT)), tileBottom = y1 < y0 ? tileTop - 1 : (int)(y1 / (tileHeight*BRAILLE_PIXELS_HEIGHT));
+
+    // bin the commands: count per tile, then place them (in call order) with a prefix sum
+    uint32_t* binStart = (uint32_t*)calloc(tileCount + 1, sizeof(uint32_t));
+    for (uint32_t i = 0; i < canvas->CommandCount; i++)
+    {
+        commandTiles(&canvas->Commands[i]);
+        for (int ty = tileTop; ty <= tileBottom; ty++)
+            for (int tx = tileLeft; tx <= tileRight; tx++)
+                binStart[ty*tilesAcross + tx + 1]++;
+    }
+
+    for (uint32_t t = 0; t < tileCount; t++)
+        binStart[t + 1] += binStart[t];
+
+    uint32_t* fill = (uint32_t*)malloc(tileCount * sizeof(uint32_t));
+    uint32_t* bins = (uint32_t*)malloc(max(binStart[tileCount], 1) * sizeof(uint32_t));
+    memcpy(fill, binStart, tileCount * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < canvas->CommandCount; i++)
+    {
+        commandTiles(&canvas->Commands[i]);
+        for (int ty = tileTop; ty <= tileBottom; ty++)
+            for (int tx = tileLeft; tx <= tileRight; tx++)
+                bins[fill[ty*tilesAcross + tx]++] = i;
+    }
+
+    #undef commandTiles
+
+    // hand the tiles to the workers and wait for them
+    pthread_mutex_lock(&pool->Lock);
+    pool->Canvas = canvas;
+    pool->TileWidth = tileWidth;
+    pool->TileHeight = tileHeight;
+    pool->TilesAcross = tilesAcross;
+    pool->TileCount = tileCount;
+    pool->BinStart = binStart;
+    pool->Bins = bins;
+    pool->NextTile = 0;
+    pool->Busy = pool->Count;
+    pool->Dirty = EMPTY_RECT;
+    pool->Ink = EMPTY_RECT;
+    pool->Generation++;
+    pthread_cond_broadcast(&pool->Wake);
+
+    while (pool->Busy)
+        pthread_cond_wait(&pool->Done, &pool->Lock);
+
+    BrailleRect_Union(&canvas->Dirty, &pool->Dirty);
+    BrailleRect_Union(&canvas->Ink, &pool->Ink);
+    pthread_mutex_unlock(&pool->Lock);
+
+    canvas->CommandCount = 0;
+
+    free(binStart);
+    free(fill);
+    free(bins);
+
+    statsEnd(BRAILLE_STAGE_RASTER);
+}
+//===========================================================================================
+
+// DISPLAY LISTS
+// a recorded sequence of drawing calls that can be replayed on any canvas
+// the list keeps the result of its last rasterization, and replays it with a plain OR of the buffers
+// for as long as neither the list nor the size and storage of the target canvas change
+//===========================================================================================
+void BrailleDisplayList_Create(BrailleDisplayList* list)
+{
+    list->Commands = NULL;
+    list->CommandCount = 0;
+    list->CommandCapacity = 0;
+    list->Version = 0;
+    list->CacheValid = 0;
+}
+
+void BrailleDisplayList_Destroy(BrailleDisplayList* list)
+{
+    free(list->Commands);
+    if (list->CacheValid)
+        BrailleCanvas_Destroy(&list->Cache);
+
+    list->Commands = NULL;
+    list->CommandCount = 0;
+    list->CommandCapacity = 0;
+    list->CacheValid = 0;
+}
+
+// forgets the recorded calls
+void BrailleDisplayList_Clear(BrailleDisplayList* list)
+{
+    list->CommandCount = 0;
+    list->Version++;
+}
+
+// drawing calls on the canvas are recorded in the list (and not drawn) until BrailleCanvas_EndRecord
+void BrailleCanvas_BeginRecord(BrailleCanvas* canvas, BrailleDisplayList* list)
+{
+    canvas->Recording = list;
+}
+
+void BrailleCanvas_EndRecord(BrailleCanvas* canvas)
+{
+    canvas->Recording = NULL;
+}
+
+// draws the recorded calls on the canvas
+void BrailleCanvas_Replay(BrailleCanvas* canvas, BrailleDisplayList* list)
+{
+    // the cache holds pixels only: colors, clipping, queueing and recording need the real calls
+    uint8_t direct = canvas->StylePlane || canvas->Workers || canvas->Recording ||
+                     canvas->Clip.Left || canvas->Clip.Top || canvas->Clip.Right < canvas->CharacterWidth || canvas->Clip.Bottom < canvas->CharacterHeight;
+
+    if (direct)
+    {
+        BrailleCellStyle pen = canvas->Pen;
+        for (uint32_t i = 0; i < list->CommandCount; i++)
+            BrailleCanvas_Execute(canvas, &list->Commands[i]);
+
+        canvas->Pen = pen;
+        return;
+    }
+
+    statsBegin(BRAILLE_STAGE_RASTER);
+
+    BrailleCanvas* cache = &list->Cache;
+    if (!list->CacheValid || list->CacheVersion != list->Version || cache->Storage != canvas->Storage ||
+        cache->CharacterWidth != canvas->CharacterWidth || cache->CharacterHeight != canvas->CharacterHeight)
+    {
+        // rasterize the list once, on a private canvas of the same size and storage
+        if (list->CacheValid)
+            BrailleCanvas_Destroy(cache);
+
+        BrailleCanvas_CreateOffscreen(cache, canvas->CharacterWidth, canvas->CharacterHeight, canvas->Storage);
+        for (uint32_t i = 0; i < list->CommandCount; i++)
+            BrailleCanvas_Execute(cache, &list->Commands[i]);
+
+        list->CacheValid = 1;
+        list->CacheVersion = list->Version;
+    }
+
+    // copy the inked part of the cache over the canvas
+    BrailleRect ink = cache->Ink;
+    if (ink.Right <= ink.Left || ink.Bottom <= ink.Top)
+    {
+        statsEnd(BRAILLE_STAGE_RASTER);
+        return;
+    }
+
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED)
+    {
+        for (uint16_t row = ink.Top; row < ink.Bottom; row++)
+        {
+            size_t offset = ink.Left + (size_t)row*canvas->CharacterWidth;
+            for (uint16_t col = 0; col < ink.Right - ink.Left; col++)
+                canvas->PixelBuffer[offset + col] |= cache->PixelBuffer[offset + col];
+        }
+    }
+    else
+    {
+        size_t width = (ink.Right - ink.Left) * BRAILLE_PIXELS_WIDTH;
+        for (int32_t y = ink.Top*BRAILLE_PIXELS_HEIGHT; y < ink.Bottom*BRAILLE_PIXELS_HEIGHT; y++)
+        {
+            size_t offset = ink.Left*BRAILLE_PIXELS_WIDTH + (size_t)y*canvas->PixelsWidth;
+            for (size_t x = 0; x < width; x++)
+                canvas->PixelBuffer[offset + x] |= cache->PixelBuffer[offset + x];
+        }
+    }
+
+    BrailleCanvas_MarkPixels(canvas, ink.Left*BRAILLE_PIXELS_WIDTH, ink.Top*BRAILLE_PIXELS_HEIGHT,
+                             ink.Right*BRAILLE_PIXELS_WIDTH - 1, ink.Bottom*BRAILLE_PIXELS_HEIGHT - 1, 1);
+
+    statsEnd(BRAILLE_STAGE_RASTER);
 }
+//===========================================================================================
\ No newline at end of file
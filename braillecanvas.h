@@ -21,34 +21,250 @@
 #include <stdint.h>
 #include "terminal.h"
 
+// pixels in one braille character
+#define BRAILLE_PIXELS_WIDTH 2
+#define BRAILLE_PIXELS_HEIGHT 4
+
+// bit of each pixel of a cell in the unicode braille pattern (and in the cells of packed storage)
+extern const uint32_t UNICODE_BRAILLE_PATTERN[BRAILLE_PIXELS_HEIGHT][BRAILLE_PIXELS_WIDTH];
+
+typedef enum {
+    BRAILLE_STORAGE_PIXELS = 0, // one byte per pixel (default)
+    BRAILLE_STORAGE_PACKED = 1, // one byte per braille cell, bits laid out as the unicode braille pattern
+} BrailleCanvasStorage;
+
+// rectangle of cells: Right and Bottom are exclusive, the rectangle is empty when Right <= Left
+typedef struct
+{
+    uint16_t Left;
+    uint16_t Top;
+    uint16_t Right;
+    uint16_t Bottom;
+} BrailleRect;
+
+// a pixel position - pixels may lie outside the canvas, drawing is clipped
+typedef struct
+{
+    int32_t X;
+    int32_t Y;
+} BraillePoint;
+
+// per-cell colors, on top of the canvas FillStyle/BackgroundStyle (TERMINAL_COLOR_DEFAULT keeps the canvas style)
+typedef struct
+{
+    TerminalColor Foreground;
+    TerminalColor Background;
+} BrailleCellStyle;
+
+// a queued drawing call: deferred tile rendering replays them once per tile
+typedef enum {
+    BRAILLE_COMMAND_LINE,
+    BRAILLE_COMMAND_FILL_RECTANGLE,
+    BRAILLE_COMMAND_STROKE_CIRCLE,
+    BRAILLE_COMMAND_FILL_CIRCLE,
+    BRAILLE_COMMAND_FILL_POLYGON, // the points follow in data commands
+    BRAILLE_COMMAND_STROKE_ARC, // ellipses too - the angles follow in a data command
+    BRAILLE_COMMAND_FILL_ARC,
+    BRAILLE_COMMAND_COUNT
+} BrailleCommandType;
+
+// which parts of a self-intersecting polygon are inside
+typedef enum {
+    BRAILLE_FILL_EVEN_ODD, // crossed by an odd number of edges on the way out
+    BRAILLE_FILL_NONZERO, // surrounded by the edges a nonzero number of times, counting their direction
+} BrailleFillRule;
+
+// arc angles are in 64ths of a degree (as in X11), counterclockwise on screen from 3 o'clock
+#define BRAILLE_DEGREES(d) ((int32_t)((d) * 64))
+
+// ellipses and arcs with a radius up to this many pixels are walked exactly; larger radii take each row from the ellipse equation
+// (in floating point, a pixel off the walk here and there), as the 64-bit decision terms of the walk would overflow
+#define BRAILLE_ELLIPSE_WALK_RADIUS 32767
+
+typedef struct
+{
+    BrailleCommandType Type;
+    int32_t Args[4];
+    BrailleCellStyle Pen;
+} BrailleDrawCommand;
+
+typedef struct BrailleWorkerPool BrailleWorkerPool;
+typedef struct BrailleDisplayList BrailleDisplayList;
+typedef struct BrailleFrameStats BrailleFrameStats;
+
 typedef struct
 {
     // placement of this canvas inside the terminal
-    uint8_t CharacterTop;
-    uint8_t CharacterLeft;
-    uint8_t CharacterWidth;
-    uint8_t CharacterHeight;
+    uint16_t CharacterTop;
+    uint16_t CharacterLeft;
+
+    // the surface being drawn on - larger than the terminal for virtual canvases
+    uint16_t CharacterWidth;
+    uint16_t CharacterHeight;
 
-    uint16_t PixelsWidth;
-    uint16_t PixelsHeight;
+    int32_t PixelsWidth;
+    int32_t PixelsHeight;
+
+    // the window of the surface printed on the terminal: its top-left cell and its size, in characters
+    uint16_t ViewColumn;
+    uint16_t ViewRow;
+    uint16_t ViewWidth;
+    uint16_t ViewHeight;
 
     ConsoleStyleText FillStyle;
     ConsoleStyleBackground BackgroundStyle;
 
+    BrailleCanvasStorage Storage;
     uint8_t *PixelBuffer;
+
+    // cells changed since the last render, and cells that may hold set pixels (cleared by WipeClean)
+    BrailleRect Dirty;
+    BrailleRect Ink;
+
+    // what was last sent to the terminal: one braille pattern per cell of the window, and the style it was printed with
+    uint8_t *FrontBuffer;
+    uint8_t FrontValid;
+    uint16_t FrontWidth; // the front buffer only knows the cells left of FrontWidth and above FrontHeight (see BrailleCanvas_Resize)
+    uint16_t FrontHeight;
+    ConsoleStyleText FrontFillStyle;
+    ConsoleStyleBackground FrontBackgroundStyle;
+
+    // optional color plane: one style per cell, stamped with the pen on every cell the drawing functions touch
+    BrailleCellStyle *StylePlane;
+    BrailleCellStyle *FrontStyles;
+    BrailleCellStyle Pen;
+
+    // cells the drawing functions are allowed to write
+    BrailleRect Clip;
+
+    // deferred tile rendering (BrailleCanvas_SetThreads): drawing calls are queued until BrailleCanvas_Flush
+    BrailleDrawCommand *Commands;
+    uint32_t CommandCount;
+    uint32_t CommandCapacity;
+    BrailleWorkerPool *Workers;
+
+    // display list receiving the drawing calls (BrailleCanvas_BeginRecord), NULL when drawing
+    BrailleDisplayList *Recording;
+
+    // performance counters (BrailleCanvas_SetStats), NULL when not collected
+    BrailleFrameStats *Stats;
 } BrailleCanvas;
 
-void BrailleCanvas_Create(BrailleCanvas*, uint8_t, uint8_t, uint8_t, uint8_t);
+// recorded drawing calls, and the canvas they were last rasterized on
+struct BrailleDisplayList
+{
+    BrailleDrawCommand *Commands;
+    uint32_t CommandCount;
+    uint32_t CommandCapacity;
+    uint32_t Version; // changes whenever the calls change
+
+    BrailleCanvas Cache;
+    uint8_t CacheValid;
+    uint32_t CacheVersion;
+};
+
+// a run of cells of one row of the window, handed to the callback of BrailleCanvas_Render_SpansByCallback
+typedef struct
+{
+    uint16_t Row; // in cells of the window, from its top-left corner
+    uint16_t Column; // first cell of the run
+    uint16_t Length; // cells in the run
+    const uint8_t* Patterns; // braille pattern of each cell
+    const char* Text; // the cells in utf-8, blank ones as a space (BRAILLE_SPAN_UTF8 only, NULL otherwise)
+    size_t TextLength; // bytes
+    const BrailleCellStyle* Styles; // color of each cell, NULL without a style plane
+} BrailleSpan;
+
+#define BRAILLE_SPAN_UTF8 0x01 // encode the runs to utf-8
+#define BRAILLE_SPAN_CHANGED 0x02 // only the cells that differ from the last render (blank ones included), instead of every non-blank cell
+
+// filled by the incremental renderer
+typedef struct
+{
+    uint32_t CellsEmitted;
+    uint32_t BytesEmitted;
+    uint8_t Dropped; // a non-blocking terminal was still busy with an earlier frame: nothing was printed, the changes wait for the next render
+} BrailleRenderStats;
+
+// the stages of a frame, as timed by the performance counters
+typedef enum {
+    BRAILLE_STAGE_RASTER, // drawing calls, and the queued ones when they are flushed
+    BRAILLE_STAGE_ENCODE, // packing and utf-8 encoding of the cells, escapes included
+    BRAILLE_STAGE_WRITE,  // sending the frame to the terminal sink
+    BRAILLE_STAGE_COUNT
+} BrailleStage;
+
+// performance counters, only collected when the library is built with BRAILLE_CANVAS_STATS defined
+// the counters accumulate until BrailleFrameStats_Reset - reset them after every frame for per-frame numbers
+struct BrailleFrameStats
+{
+    uint64_t PixelsWritten[BRAILLE_COMMAND_COUNT]; // per drawing call type (rectangle strokes count as lines)
+    uint64_t CellsEncoded;
+    uint64_t BytesEmitted;
+    uint64_t EscapesEmitted;
+    uint64_t Nanoseconds[BRAILLE_STAGE_COUNT];
+
+    // optional tracer: called when a stage begins (begin = 1) and when it ends (begin = 0)
+    void (*Trace)(BrailleCanvas* canvas, BrailleStage stage, uint8_t begin, void* object);
+    void* TraceObject;
+};
+
+void BrailleRect_Union(BrailleRect*, const BrailleRect*);
+void BrailleRect_Intersect(BrailleRect*, const BrailleRect*);
+
+void BrailleCanvas_Create(BrailleCanvas*, uint16_t, uint16_t, uint16_t, uint16_t);
+void BrailleCanvas_CreateEx(BrailleCanvas*, uint16_t, uint16_t, uint16_t, uint16_t, BrailleCanvasStorage);
+void BrailleCanvas_CreateVirtual(BrailleCanvas*, uint16_t, uint16_t, uint16_t viewWidth, uint16_t viewHeight, uint16_t width, uint16_t height, BrailleCanvasStorage);
+void BrailleCanvas_CreateOffscreen(BrailleCanvas*, uint16_t width, uint16_t height, BrailleCanvasStorage);
 void BrailleCanvas_Destroy(BrailleCanvas*);
+void BrailleCanvas_Resize(BrailleCanvas*, uint16_t, uint16_t);
+void BrailleCanvas_SetView(BrailleCanvas*, int32_t column, int32_t row, uint16_t width, uint16_t height);
 void BrailleCanvas_Render(BrailleCanvas*);
+void BrailleCanvas_RenderDiff(BrailleCanvas*, BrailleRenderStats*);
+void BrailleCanvas_Invalidate(BrailleCanvas*);
 void BrailleCanvas_Render_ByCallback(BrailleCanvas* canvas, void*object, void(*SetFunc)(uint8_t, uint8_t, uint8_t, uint8_t, char*,void*object));
+void BrailleCanvas_Render_DirtyByCallback(BrailleCanvas* canvas, void*object, void(*SetFunc)(uint8_t, uint8_t, uint8_t, uint8_t, char*,void*object));
+void BrailleCanvas_Render_SpansByCallback(BrailleCanvas*, void* object, uint8_t flags, void(*SpanFunc)(const BrailleSpan*, void* object));
+void BrailleCanvas_GetCharacter(BrailleCanvas*, uint16_t row, uint16_t col, uint32_t* unicode);
+void BrailleCanvas_PackRow(BrailleCanvas*, uint16_t row, uint16_t col, uint16_t count, uint8_t* patterns);
+void BrailleCanvas_UnpackRow(BrailleCanvas*, uint16_t row, uint16_t col, uint16_t count, const uint8_t* patterns);
+const char* BrailleCanvas_GetPackKernel();
+char* BrailleCanvas_EncodeRow(const uint8_t* patterns, uint16_t count, char* out);
+void BrailleCanvas_MarkDirty(BrailleCanvas*, int32_t, int32_t, int32_t, int32_t);
+
+void BrailleCanvas_EnableStylePlane(BrailleCanvas*);
+void BrailleCanvas_SetPen(BrailleCanvas*, TerminalColor, TerminalColor);
+void BrailleCanvas_SetCellStyle(BrailleCanvas*, uint16_t col, uint16_t row, TerminalColor, TerminalColor);
+
+void BrailleCanvas_SetStats(BrailleCanvas*, BrailleFrameStats*);
+void BrailleFrameStats_Reset(BrailleFrameStats*);
+
+void BrailleCanvas_SetThreads(BrailleCanvas*, uint8_t);
+void BrailleCanvas_Flush(BrailleCanvas*);
+
+void BrailleDisplayList_Create(BrailleDisplayList*);
+void BrailleDisplayList_Destroy(BrailleDisplayList*);
+void BrailleDisplayList_Clear(BrailleDisplayList*);
+void BrailleCanvas_BeginRecord(BrailleCanvas*, BrailleDisplayList*);
+void BrailleCanvas_EndRecord(BrailleCanvas*);
+void BrailleCanvas_Replay(BrailleCanvas*, BrailleDisplayList*);
 
 void BrailleCanvas_WipeClean(BrailleCanvas*);
-void BrailleCanvas_FillRectangle(BrailleCanvas*, uint16_t, uint16_t, uint16_t, uint16_t);
-void BrailleCanvas_FillCircle(BrailleCanvas*, uint16_t, uint16_t, uint16_t);
+void BrailleCanvas_ShiftCells(BrailleCanvas*, int32_t columns, int32_t rows);
+void BrailleCanvas_SetPixel(BrailleCanvas*, int32_t, int32_t);
+void BrailleCanvas_ClearPixel(BrailleCanvas*, int32_t, int32_t);
+uint8_t BrailleCanvas_GetPixel(BrailleCanvas*, int32_t, int32_t);
+void BrailleCanvas_FillRectangle(BrailleCanvas*, int32_t, int32_t, int32_t, int32_t);
+void BrailleCanvas_FillCircle(BrailleCanvas*, int32_t, int32_t, int32_t);
+void BrailleCanvas_FillEllipse(BrailleCanvas*, int32_t x, int32_t y, int32_t rx, int32_t ry);
+void BrailleCanvas_FillArc(BrailleCanvas*, int32_t x, int32_t y, int32_t rx, int32_t ry, int32_t start, int32_t extent);
+void BrailleCanvas_FillPolygon(BrailleCanvas*, const BraillePoint*, uint32_t count, BrailleFillRule);
 
-void BrailleCanvas_StrokeRectangle(BrailleCanvas*, uint16_t, uint16_t, uint16_t, uint16_t);
-void BrailleCanvas_StrokeCircle(BrailleCanvas*, uint16_t, uint16_t, uint16_t);
-void BrailleCanvas_StrokeLine(BrailleCanvas*, uint16_t, uint16_t, uint16_t, uint16_t);
+void BrailleCanvas_StrokeRectangle(BrailleCanvas*, int32_t, int32_t, int32_t, int32_t);
+void BrailleCanvas_StrokeCircle(BrailleCanvas*, int32_t, int32_t, int32_t);
+void BrailleCanvas_StrokeEllipse(BrailleCanvas*, int32_t x, int32_t y, int32_t rx, int32_t ry);
+void BrailleCanvas_StrokeArc(BrailleCanvas*, int32_t x, int32_t y, int32_t rx, int32_t ry, int32_t start, int32_t extent);
+void BrailleCanvas_StrokeLine(BrailleCanvas*, int32_t, int32_t, int32_t, int32_t);
+void BrailleCanvas_StrokePolyline(BrailleCanvas*, const BraillePoint*, uint32_t count);
 
 #endif // _BRAILLE_CANVAS_H_
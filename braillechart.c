@@ -0,0 +1,152 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+#include "braillechart.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+int BrailleChart_Create(BrailleChart* chart, BrailleCanvas* canvas, uint32_t capacity, float minimum, float maximum)
+{
+    chart->Canvas = canvas;
+    chart->Minimum = minimum;
+    chart->Maximum = maximum;
+    chart->Capacity = capacity;
+    chart->Count = 0;
+    chart->Origin = 0;
+    chart->Plotted = 0;
+
+    chart->Samples = (float*)malloc((size_t)capacity * sizeof(float));
+    if (capacity == 0 || !chart->Samples)
+    {
+        fprintf(stderr, "BrailleChart_Create: unable to allocate %u samples\n", capacity);
+        free(chart->Samples);
+        chart->Samples = NULL;
+        chart->Capacity = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void BrailleChart_Destroy(BrailleChart* chart)
+{
+    free(chart->Samples);
+    chart->Samples = NULL;
+    chart->Capacity = 0;
+    chart->Count = 0;
+}
+
+// forgets every sample and blanks the canvas
+void BrailleChart_Clear(BrailleChart* chart)
+{
+    chart->Count = 0;
+    chart->Origin = 0;
+    chart->Plotted = 0;
+    BrailleCanvas_WipeClean(chart->Canvas);
+}
+
+void BrailleChart_Push(BrailleChart* chart, float value)
+{
+    if (chart->Capacity == 0)
+        return;
+
+    chart->Samples[chart->Count % chart->Capacity] = value;
+    chart->Count++;
+}
+
+void BrailleChart_PushMany(BrailleChart* chart, const float* values, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        BrailleChart_Push(chart, values[i]);
+}
+
+// pixel row of a value: Maximum on the top row, Minimum on the bottom one
+static int32_t BrailleChart_Row(BrailleChart* chart, float value)
+{
+    int32_t bottom = chart->Canvas->PixelsHeight - 1;
+    float range = chart->Maximum - chart->Minimum;
+    float row = range != 0 ? (chart->Maximum - value) / range * bottom : bottom;
+
+    if (!(row > 0)) // also catches NAN ranges
+        return 0;
+
+    return row < bottom ? (int32_t)(row + 0.5f) : bottom;
+}
+
+// draws sample number "n" on its column, joined to the sample before it if that one is still known
+static void BrailleChart_Plot(BrailleChart* chart, uint64_t n)
+{
+    float value = chart->Samples[n % chart->Capacity];
+    if (isnan(value))
+        return;
+
+    int32_t x = (int32_t)(n - chart->Origin);
+    int32_t y = BrailleChart_Row(chart, value);
+
+    if (n > 0 && chart->Count - (n - 1) <= chart->Capacity && !isnan(chart->Samples[(n - 1) % chart->Capacity]))
+        BrailleCanvas_StrokeLine(chart->Canvas, x - 1, BrailleChart_Row(chart, chart->Samples[(n - 1) % chart->Capacity]), x, y); // clipped when x - 1 scrolled out
+    else
+        BrailleCanvas_SetPixel(chart->Canvas, x, y);
+}
+
+void BrailleChart_Draw(BrailleChart* chart)
+{
+    BrailleCanvas* canvas = chart->Canvas;
+    uint64_t width = (uint64_t)canvas->PixelsWidth;
+
+    // make room for the new samples by whole cells: the pixels drawn so far move along unchanged
+    if (chart->Count > chart->Origin + width)
+    {
+        uint64_t shift = (chart->Count - chart->Origin - width + BRAILLE_PIXELS_WIDTH - 1) / BRAILLE_PIXELS_WIDTH * BRAILLE_PIXELS_WIDTH;
+        chart->Origin += shift;
+
+        if (shift < width)
+            BrailleCanvas_ShiftCells(canvas, -(int32_t)(shift / BRAILLE_PIXELS_WIDTH), 0);
+        else
+            BrailleCanvas_WipeClean(canvas);
+    }
+
+    // only the samples still in the ring buffer and on the canvas can be drawn
+    uint64_t first = chart->Plotted;
+    first = first > chart->Origin ? first : chart->Origin;
+    if (chart->Count > chart->Capacity && first < chart->Count - chart->Capacity)
+        first = chart->Count - chart->Capacity;
+
+    for (uint64_t n = first; n < chart->Count; n++)
+        BrailleChart_Plot(chart, n);
+
+    chart->Plotted = chart->Count;
+}
+
+void BrailleChart_Redraw(BrailleChart* chart)
+{
+    BrailleCanvas_WipeClean(chart->Canvas);
+
+    // the newest samples end on the right edge, as they would have after drawing tick by tick
+    uint64_t width = (uint64_t)chart->Canvas->PixelsWidth;
+    chart->Origin = chart->Count > width ? (chart->Count - width + BRAILLE_PIXELS_WIDTH - 1) / BRAILLE_PIXELS_WIDTH * BRAILLE_PIXELS_WIDTH : 0;
+    chart->Plotted = chart->Origin;
+
+    BrailleChart_Draw(chart);
+}
+
+void BrailleChart_SetRange(BrailleChart* chart, float minimum, float maximum)
+{
+    chart->Minimum = minimum;
+    chart->Maximum = maximum;
+    BrailleChart_Redraw(chart);
+}
@@ -0,0 +1,55 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+#ifndef _BRAILLE_CHART_H_
+#define _BRAILLE_CHART_H_
+
+#include "braillecanvas.h"
+
+// scrolling strip chart: one sample per pixel column, the newest on the right, consecutive samples joined by lines
+// samples are kept in a ring buffer; when the chart is full, drawing shifts the canvas left by whole cells
+// and rasterizes only the samples not drawn yet, so a tick costs as much as the samples it adds
+typedef struct
+{
+    BrailleCanvas* Canvas; // drawn on, not owned - the chart covers all of it
+
+    // values shown on the bottom and top pixel rows (values outside are drawn on the edges)
+    float Minimum;
+    float Maximum;
+
+    // the newest samples: sample number i (counted from the first one pushed) is at Samples[i % Capacity]
+    float* Samples;
+    uint32_t Capacity;
+    uint64_t Count;
+
+    uint64_t Origin; // sample drawn on the leftmost pixel column, a multiple of BRAILLE_PIXELS_WIDTH
+    uint64_t Plotted; // samples already drawn
+} BrailleChart;
+
+// "capacity" should be at least one more than the pixel width of the canvas to fill the chart
+// returns 0 on success
+int BrailleChart_Create(BrailleChart*, BrailleCanvas*, uint32_t capacity, float minimum, float maximum);
+void BrailleChart_Destroy(BrailleChart*);
+void BrailleChart_Clear(BrailleChart*);
+
+void BrailleChart_Push(BrailleChart*, float value); // NAN leaves a gap
+void BrailleChart_PushMany(BrailleChart*, const float* values, uint32_t count);
+
+void BrailleChart_Draw(BrailleChart*); // draws the samples pushed since the last draw
+void BrailleChart_Redraw(BrailleChart*); // draws every sample again (after changing the range, the pen, or the canvas size)
+void BrailleChart_SetRange(BrailleChart*, float minimum, float maximum);
+
+#endif // _BRAILLE_CHART_H_
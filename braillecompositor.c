@@ -0,0 +1,389 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+#include "braillecompositor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// unchanged cells shorter than this are reprinted instead of jumping over them with the cursor
+#define COMPOSE_MIN_GAP 4
+
+#define sameColors(a,b) ((a).Foreground == (b).Foreground && (a).Background == (b).Background)
+#define sameLook(a,b) ((a).FillStyle == (b).FillStyle && (a).BackgroundStyle == (b).BackgroundStyle && sameColors((a).Colors, (b).Colors))
+#define sameCell(a,b) ((a).Covered == (b).Covered && (a).Pattern == (b).Pattern && sameLook(a,b))
+
+int BrailleCompositor_Create(BrailleCompositor* compositor, uint16_t width, uint16_t height)
+{
+    memset(compositor, 0, sizeof(BrailleCompositor));
+
+    size_t cells = (size_t)width * height;
+    compositor->Back = (BrailleScreenCell*)calloc(cells, sizeof(BrailleScreenCell));
+    compositor->Front = (BrailleScreenCell*)calloc(cells, sizeof(BrailleScreenCell));
+    if (!compositor->Back || !compositor->Front)
+    {
+        fprintf(stderr, "BrailleCompositor_Create: unable to allocate a %ux%u screen\n", width, height);
+        BrailleCompositor_Destroy(compositor);
+        return -1;
+    }
+
+    compositor->Width = width;
+    compositor->Height = height;
+    compositor->FillStyle = CONSOLE_STYLE_TEXT_WHITE;
+    compositor->BackgroundStyle = CONSOLE_STYLE_BACKGROUND_BLACK;
+    return 0;
+}
+
+void BrailleCompositor_Destroy(BrailleCompositor* compositor)
+{
+    free(compositor->Layers);
+    free(compositor->Back);
+    free(compositor->Front);
+    memset(compositor, 0, sizeof(BrailleCompositor));
+}
+
+static BrailleLayer* BrailleCompositor_Find(BrailleCompositor* compositor, BrailleCanvas* canvas)
+{
+    for (uint16_t i = 0; i < compositor->LayerCount; i++)
+        if (compositor->Layers[i].Canvas == canvas)
+            return &compositor->Layers[i];
+
+    return NULL;
+}
+
+// keeps the layers sorted from the bottom up (insertion sort: the list is short and almost always sorted)
+static void BrailleCompositor_Sort(BrailleCompositor* compositor)
+{
+    BrailleLayer* layers = compositor->Layers;
+    for (uint16_t i = 1; i < compositor->LayerCount; i++)
+    {
+        BrailleLayer layer = layers[i];
+        uint16_t j = i;
+        while (j > 0 && (layers[j-1].Z > layer.Z || (layers[j-1].Z == layer.Z && layers[j-1].Order > layer.Order)))
+        {
+            layers[j] = layers[j-1];
+            j--;
+        }
+        layers[j] = layer;
+    }
+}
+
+// screen cells covered by the window of a canvas
+static BrailleRect BrailleCompositor_Placement(BrailleCompositor* compositor, BrailleCanvas* canvas)
+{
+    BrailleRect screen = {0, 0, compositor->Width, compositor->Height};
+    BrailleRect placed = {canvas->CharacterLeft, canvas->CharacterTop, canvas->CharacterLeft + canvas->ViewWidth, canvas->CharacterTop + canvas->ViewHeight};
+    BrailleRect_Intersect(&placed, &screen);
+    return placed;
+}
+
+int BrailleCompositor_Add(BrailleCompositor* compositor, BrailleCanvas* canvas, int16_t z)
+{
+    if (BrailleCompositor_Find(compositor, canvas))
+    {
+        BrailleCompositor_SetZ(compositor, canvas, z);
+        return 0;
+    }
+
+    if (compositor->LayerCount == compositor->LayerCapacity)
+    {
+        uint16_t capacity = compositor->LayerCapacity ? compositor->LayerCapacity * 2 : 8;
+        BrailleLayer* layers = (BrailleLayer*)realloc(compositor->Layers, capacity * sizeof(BrailleLayer));
+        if (!layers)
+        {
+            fprintf(stderr, "BrailleCompositor_Add: unable to allocate %u layers\n", capacity);
+            return -1;
+        }
+
+        compositor->Layers = layers;
+        compositor->LayerCapacity = capacity;
+    }
+
+    BrailleLayer* layer = &compositor->Layers[compositor->LayerCount++];
+    memset(layer, 0, sizeof(BrailleLayer));
+    layer->Canvas = canvas;
+    layer->Z = z;
+    layer->Order = compositor->NextOrder++;
+    layer->Visible = 1;
+    layer->Placed = (BrailleRect){0, 0, 0, 0}; // not on screen yet: the first render composes all of it
+
+    BrailleCompositor_Sort(compositor);
+    return 0;
+}
+
+void BrailleCompositor_Remove(BrailleCompositor* compositor, BrailleCanvas* canvas)
+{
+    BrailleLayer* layer = BrailleCompositor_Find(compositor, canvas);
+    if (!layer)
+        return;
+
+    BrailleRect_Union(&compositor->Dirty, &layer->Placed); // what was under it shows again
+
+    uint16_t index = layer - compositor->Layers;
+    memmove(layer, layer + 1, (compositor->LayerCount - index - 1) * sizeof(BrailleLayer));
+    compositor->LayerCount--;
+}
+
+void BrailleCompositor_SetZ(BrailleCompositor* compositor, BrailleCanvas* canvas, int16_t z)
+{
+    BrailleLayer* layer = BrailleCompositor_Find(compositor, canvas);
+    if (!layer || layer->Z == z)
+        return;
+
+    layer->Z = z;
+    BrailleRect_Union(&compositor->Dirty, &layer->Placed);
+    BrailleCompositor_Sort(compositor);
+}
+
+void BrailleCompositor_SetVisible(BrailleCompositor* compositor, BrailleCanvas* canvas, uint8_t visible)
+{
+    BrailleLayer* layer = BrailleCompositor_Find(compositor, canvas);
+    if (layer)
+        layer->Visible = visible; // the render notices the placement changed
+}
+
+void BrailleCompositor_Invalidate(BrailleCompositor* compositor)
+{
+    compositor->FrontValid = 0;
+    compositor->Dirty = (BrailleRect){0, 0, compositor->Width, compositor->Height};
+}
+
+// collects the screen cells whose content may have changed since the last render
+static void BrailleCompositor_CollectDirty(BrailleCompositor* compositor)
+{
+    for (uint16_t i = 0; i < compositor->LayerCount; i++)
+    {
+        BrailleLayer* layer = &compositor->Layers[i];
+        BrailleCanvas* canvas = layer->Canvas;
+
+        BrailleCanvas_Flush(canvas); // rasterize the queued drawing calls first
+
+        BrailleRect placed = layer->Visible ? BrailleCompositor_Placement(compositor, canvas) : (BrailleRect){0, 0, 0, 0};
+        if (placed.Left != layer->Placed.Left || placed.Top != layer->Placed.Top || placed.Right != layer->Placed.Right || placed.Bottom != layer->Placed.Bottom ||
+            canvas->ViewColumn != layer->ViewColumn || canvas->ViewRow != layer->ViewRow ||
+            canvas->FillStyle != layer->FillStyle || canvas->BackgroundStyle != layer->BackgroundStyle)
+        {
+            // moved, resized, panned, shown, hidden or restyled: all of it, and all it left
+            BrailleRect_Union(&compositor->Dirty, &layer->Placed);
+            BrailleRect_Union(&compositor->Dirty, &placed);
+        }
+        else if (placed.Right > placed.Left)
+        {
+            // the changed cells of its window, on the screen
+            BrailleRect view = {canvas->ViewColumn, canvas->ViewRow, canvas->ViewColumn + canvas->ViewWidth, canvas->ViewRow + canvas->ViewHeight};
+            BrailleRect dirty = canvas->Dirty;
+            BrailleRect_Intersect(&dirty, &view);
+
+            if (dirty.Right > dirty.Left)
+            {
+                dirty = (BrailleRect){
+                    canvas->CharacterLeft + dirty.Left - view.Left, canvas->CharacterTop + dirty.Top - view.Top,
+                    canvas->CharacterLeft + dirty.Right - view.Left, canvas->CharacterTop + dirty.Bottom - view.Top
+                };
+                BrailleRect_Intersect(&dirty, &placed);
+                BrailleRect_Union(&compositor->Dirty, &dirty);
+            }
+        }
+
+        layer->Placed = placed;
+        layer->ViewColumn = canvas->ViewColumn;
+        layer->ViewRow = canvas->ViewRow;
+        layer->FillStyle = canvas->FillStyle;
+        layer->BackgroundStyle = canvas->BackgroundStyle;
+        canvas->Dirty = (BrailleRect){0, 0, 0, 0}; // the compositor owns these changes now
+    }
+}
+
+// paints the dirty cells of the back screen from the bottom layer up
+static void BrailleCompositor_Compose(BrailleCompositor* compositor)
+{
+    BrailleRect dirty = compositor->Dirty;
+    BrailleScreenCell blank = {0, 0, compositor->FillStyle, compositor->BackgroundStyle, {TERMINAL_COLOR_DEFAULT, TERMINAL_COLOR_DEFAULT}};
+
+    for (uint16_t y = dirty.Top; y < dirty.Bottom; y++)
+        for (uint16_t x = dirty.Left; x < dirty.Right; x++)
+            compositor->Back[x + (size_t)y * compositor->Width] = blank;
+
+    uint8_t patterns[compositor->Width];
+
+    for (uint16_t i = 0; i < compositor->LayerCount; i++)
+    {
+        BrailleLayer* layer = &compositor->Layers[i];
+        BrailleCanvas* canvas = layer->Canvas;
+
+        BrailleRect area = layer->Placed;
+        BrailleRect_Intersect(&area, &dirty);
+        if (area.Right <= area.Left)
+            continue;
+
+        uint16_t count = area.Right - area.Left;
+        for (uint16_t y = area.Top; y < area.Bottom; y++)
+        {
+            uint16_t row = canvas->ViewRow + (y - canvas->CharacterTop);
+            uint16_t column = canvas->ViewColumn + (area.Left - canvas->CharacterLeft);
+            BrailleCanvas_PackRow(canvas, row, column, count, patterns);
+
+            const BrailleCellStyle* styles = canvas->StylePlane ? &canvas->StylePlane[column + (size_t)row * canvas->CharacterWidth] : NULL;
+            BrailleScreenCell* cell = &compositor->Back[area.Left + (size_t)y * compositor->Width];
+
+            for (uint16_t c = 0; c < count; c++, cell++)
+            {
+                cell->Pattern = patterns[c];
+                cell->Covered = 1;
+                cell->FillStyle = canvas->FillStyle;
+                cell->BackgroundStyle = canvas->BackgroundStyle;
+                cell->Colors = styles ? styles[c] : blank.Colors;
+            }
+        }
+    }
+}
+
+// prints a run of cells - the cursor must already be at the first one, and "current" is the style the terminal is in
+static int BrailleCompositor_WriteRun(const BrailleScreenCell* cells, uint16_t count, BrailleScreenCell* current, uint8_t* started, char* buffer)
+{
+    int bytes = 0;
+    uint16_t c = 0;
+
+    while (c < count)
+    {
+        uint16_t run = c + 1; // cells printed in the same style
+        while (run < count && sameLook(cells[run], cells[c]))
+            run++;
+
+        if (!*started || !sameLook(cells[c], *current))
+        {
+            bytes += Terminal_SetStyle(cells[c].FillStyle, cells[c].BackgroundStyle) + Terminal_SetColor(cells[c].Colors.Foreground, cells[c].Colors.Background);
+            *current = cells[c];
+            *started = 1;
+        }
+
+        char* text = buffer;
+        for (uint16_t k = c; k < run; k++)
+        {
+            if (cells[k].Covered)
+            {
+                uint8_t pattern = cells[k].Pattern;
+                text = BrailleCanvas_EncodeRow(&pattern, 1, text);
+            }
+            else
+                *text++ = ' ';
+        }
+
+        bytes += Terminal_Write(buffer, text - buffer);
+        c = run;
+    }
+
+    return bytes;
+}
+
+void BrailleCompositor_Render(BrailleCompositor* compositor, BrailleRenderStats* stats)
+{
+    if (compositor->Width == 0 || compositor->Height == 0) // an empty screen: nothing to print
+    {
+        if (stats)
+            *stats = (BrailleRenderStats){0, 0, 0};
+
+        return;
+    }
+
+    if (!Terminal_Ready()) // a non-blocking terminal is still busy: the canvases keep their dirty regions for the next render
+    {
+        Terminal_DropFrame();
+        if (stats)
+            *stats = (BrailleRenderStats){0, 0, 1};
+
+        return;
+    }
+
+    uint32_t cells = 0;
+    uint32_t bytes = 0;
+
+    BrailleCompositor_CollectDirty(compositor);
+    BrailleCompositor_Compose(compositor);
+
+    BrailleRect dirty = compositor->Dirty;
+    uint8_t repaint = !compositor->FrontValid;
+    uint8_t saved = 0, styled = 0;
+    BrailleScreenCell current;
+    memset(&current, 0, sizeof(current));
+
+    char buffer[compositor->Width * 3 + 1]; // worst case: a braille character (3 bytes in utf-8) per cell
+
+    Terminal_BeginFrame(); // every canvas goes out to the terminal in a single write
+
+    for (uint16_t y = dirty.Top; y < dirty.Bottom; y++)
+    {
+        const BrailleScreenCell* back = &compositor->Back[(size_t)y * compositor->Width];
+        const BrailleScreenCell* front = &compositor->Front[(size_t)y * compositor->Width];
+
+        // cells no canvas covers now or before were never ours; the others are printed when they look different
+        #define cellChanged(c) ((back[c].Covered || front[c].Covered) && (repaint || !sameCell(back[c], front[c])))
+
+        uint16_t x = dirty.Left;
+        while (x < dirty.Right)
+        {
+            if (!cellChanged(x))
+            {
+                x++;
+                continue;
+            }
+
+            // the run absorbs short gaps of unchanged cells, cheaper to reprint than to jump
+            uint16_t start = x;
+            uint16_t end = x + 1;
+            uint16_t gap = 0;
+            for (uint16_t next = end; next < dirty.Right && gap < COMPOSE_MIN_GAP; next++)
+            {
+                if (cellChanged(next))
+                {
+                    end = next + 1;
+                    gap = 0;
+                }
+                else
+                    gap++;
+            }
+
+            if (!saved)
+            {
+                bytes += Terminal_SaveCursorPosition();
+                saved = 1;
+            }
+
+            bytes += Terminal_SetCursorPosition(start, y);
+            bytes += BrailleCompositor_WriteRun(&back[start], end - start, &current, &styled, buffer);
+
+            cells += end - start;
+            x = end;
+        }
+
+        #undef cellChanged
+
+        memcpy(&compositor->Front[dirty.Left + (size_t)y * compositor->Width], &back[dirty.Left], (dirty.Right - dirty.Left) * sizeof(BrailleScreenCell));
+    }
+
+    if (saved)
+        bytes += Terminal_RestoreCursorSavedPosition();
+
+    int sent = Terminal_EndFrame();
+
+    compositor->FrontValid = 1;
+    compositor->Dirty = (BrailleRect){0, 0, 0, 0};
+    if (sent < 0)
+        BrailleCompositor_Invalidate(compositor); // a frame lost on the way leaves the screen unknown: the next render repaints it
+
+    if (stats)
+        *stats = sent >= 0 ? (BrailleRenderStats){cells, bytes, 0} : (BrailleRenderStats){0, 0, 1};
+}
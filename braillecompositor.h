@@ -0,0 +1,86 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+#ifndef _BRAILLE_COMPOSITOR_H_
+#define _BRAILLE_COMPOSITOR_H_
+
+#include "braillecanvas.h"
+
+// what the terminal shows in one cell
+typedef struct
+{
+    uint8_t Pattern;
+    uint8_t Covered; // 0: no canvas is over the cell, it is printed as a blank in the style of the compositor
+    ConsoleStyleText FillStyle;
+    ConsoleStyleBackground BackgroundStyle;
+    BrailleCellStyle Colors;
+} BrailleScreenCell;
+
+// a canvas on the screen - it is placed at its CharacterLeft, CharacterTop and shows its window (ViewWidth x ViewHeight)
+// moving it is changing those: the next render notices
+typedef struct
+{
+    BrailleCanvas* Canvas;
+    int16_t Z; // layers with higher Z hide the ones below, layers with the same Z are stacked in the order they were added
+    uint32_t Order;
+    uint8_t Visible;
+
+    // the screen cells it covered and how it looked when it was last composed
+    BrailleRect Placed;
+    uint16_t ViewColumn;
+    uint16_t ViewRow;
+    ConsoleStyleText FillStyle;
+    ConsoleStyleBackground BackgroundStyle;
+} BrailleLayer;
+
+// prints several canvases sharing the terminal as a single screen: each cell shows the topmost canvas over it,
+// and a render prints only the cells whose visible content changed, in one frame
+// the canvases added are printed by the compositor only: it takes over their dirty regions
+typedef struct
+{
+    uint16_t Width; // screen size, in terminal positions
+    uint16_t Height;
+
+    BrailleLayer* Layers; // sorted from the bottom up
+    uint16_t LayerCount;
+    uint16_t LayerCapacity;
+    uint32_t NextOrder;
+
+    // the screen being composed, and what was last sent to the terminal
+    BrailleScreenCell* Back;
+    BrailleScreenCell* Front;
+    uint8_t FrontValid;
+    BrailleRect Dirty; // cells to compose again
+
+    // style of the cells no canvas covers (white on black unless changed)
+    ConsoleStyleText FillStyle;
+    ConsoleStyleBackground BackgroundStyle;
+} BrailleCompositor;
+
+// returns 0 on success
+int BrailleCompositor_Create(BrailleCompositor*, uint16_t width, uint16_t height);
+void BrailleCompositor_Destroy(BrailleCompositor*);
+
+// returns 0 on success
+int BrailleCompositor_Add(BrailleCompositor*, BrailleCanvas*, int16_t z);
+void BrailleCompositor_Remove(BrailleCompositor*, BrailleCanvas*);
+void BrailleCompositor_SetZ(BrailleCompositor*, BrailleCanvas*, int16_t z);
+void BrailleCompositor_SetVisible(BrailleCompositor*, BrailleCanvas*, uint8_t visible);
+
+void BrailleCompositor_Invalidate(BrailleCompositor*); // forgets what is on screen: the next render prints every covered cell
+void BrailleCompositor_Render(BrailleCompositor*, BrailleRenderStats* stats);
+
+#endif // _BRAILLE_COMPOSITOR_H_
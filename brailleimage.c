@@ -0,0 +1,524 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+#include "brailleimage.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if (defined(WIN32) || defined(_WIN32) || defined(__WIN32) || defined(__WIN32__))
+    #define BRAILLE_IMAGE_MMAP 0
+#else
+    #define BRAILLE_IMAGE_MMAP 1
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+// 8x8 Bayer matrix: the order in which the pixels of a block light up as the gray level rises
+static const uint8_t BAYER_8X8[8][8] = {
+    { 0, 32,  8, 40,  2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44,  4, 36, 14, 46,  6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    { 3, 35, 11, 43,  1, 33,  9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47,  7, 39, 13, 45,  5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+int BrailleImage_Wrap(BrailleImage* image, const uint8_t* data, int32_t width, int32_t height, size_t stride, uint8_t channels)
+{
+    memset(image, 0, sizeof(BrailleImage));
+
+    if (width <= 0 || height <= 0 || (channels != 1 && channels != 3) || stride < (size_t)width * channels)
+    {
+        fprintf(stderr, "BrailleImage_Wrap: invalid %dx%d image with %u channels and stride %zu\n", width, height, channels, stride);
+        return -1;
+    }
+
+    image->Data = data;
+    image->Width = width;
+    image->Height = height;
+    image->Stride = stride;
+    image->Channels = channels;
+    image->Maximum = 255;
+    return 0;
+}
+
+// PNM HEADER
+//===========================================================================================
+// bytes of a header, from memory or from a stream
+typedef struct
+{
+    const uint8_t* Data;
+    size_t Size;
+    size_t Position;
+    FILE* Stream;
+} BrailleImageReader;
+
+// next byte, or EOF
+static int BrailleImage_NextByte(BrailleImageReader* reader)
+{
+    if (reader->Stream)
+        return fgetc(reader->Stream);
+
+    return reader->Position < reader->Size ? reader->Data[reader->Position++] : EOF;
+}
+
+// a decimal number after whitespace and comments - -1 if there is none
+static int32_t BrailleImage_NextNumber(BrailleImageReader* reader)
+{
+    int c = BrailleImage_NextByte(reader);
+    while (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '#')
+    {
+        if (c == '#')
+            while (c != '\n' && c != EOF)
+                c = BrailleImage_NextByte(reader);
+
+        c = BrailleImage_NextByte(reader);
+    }
+
+    if (c < '0' || c > '9')
+        return -1;
+
+    int32_t value = 0;
+    while (c >= '0' && c <= '9')
+    {
+        if (value > (INT32_MAX - 9) / 10)
+            return -1;
+
+        value = value*10 + (c - '0');
+        c = BrailleImage_NextByte(reader);
+    }
+
+    // "c" was the single whitespace byte ending the number: after the maximum sample value, the raster starts
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' ? value : -1;
+}
+
+// parses "P5"/"P6", the size and the maximum sample value - the reader is left at the first byte of the raster
+static int BrailleImage_ParseHeader(BrailleImage* image, BrailleImageReader* reader, const char* caller)
+{
+    int p = BrailleImage_NextByte(reader);
+    if (p == EOF) // the end of a stream of images
+        return -1;
+
+    int kind = BrailleImage_NextByte(reader);
+    if (p != 'P' || (kind != '5' && kind != '6'))
+    {
+        fprintf(stderr, "%s: not a binary PGM or PPM image\n", caller);
+        return -1;
+    }
+
+    int32_t width = BrailleImage_NextNumber(reader);
+    int32_t height = BrailleImage_NextNumber(reader);
+    int32_t maximum = BrailleImage_NextNumber(reader);
+    if (width <= 0 || height <= 0 || maximum <= 0 || maximum > 255)
+    {
+        fprintf(stderr, "%s: unsupported image header (%d x %d, maximum value %d): 8-bit samples only\n", caller, width, height, maximum);
+        return -1;
+    }
+
+    image->Width = width;
+    image->Height = height;
+    image->Channels = kind == '6' ? 3 : 1;
+    image->Stride = (size_t)width * image->Channels;
+    image->Maximum = (uint8_t)maximum;
+    return 0;
+}
+//===========================================================================================
+
+int BrailleImage_Load(BrailleImage* image, const char* path)
+{
+    memset(image, 0, sizeof(BrailleImage));
+
+    #if BRAILLE_IMAGE_MMAP
+    int file = open(path, O_RDONLY);
+    if (file < 0)
+    {
+        fprintf(stderr, "BrailleImage_Load: unable to open %s\n", path);
+        return -1;
+    }
+
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    if (fstat(file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+        mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+    close(file);
+
+    if (mapping != MAP_FAILED)
+    {
+        image->Mapping = mapping;
+        image->MappingSize = (size_t)info.st_size;
+
+        BrailleImageReader reader = {(const uint8_t*)mapping, image->MappingSize, 0, NULL};
+        if (BrailleImage_ParseHeader(image, &reader, "BrailleImage_Load") != 0)
+        {
+            BrailleImage_Destroy(image);
+            return -1;
+        }
+
+        if (image->MappingSize - reader.Position < image->Stride * image->Height)
+        {
+            fprintf(stderr, "BrailleImage_Load: %s is truncated\n", path);
+            BrailleImage_Destroy(image);
+            return -1;
+        }
+
+        image->Data = (const uint8_t*)mapping + reader.Position;
+        return 0;
+    }
+    #endif
+
+    // no mapping (other platforms, pipes, special files): streamed into a buffer
+    FILE* stream = fopen(path, "rb");
+    if (!stream)
+    {
+        fprintf(stderr, "BrailleImage_Load: unable to open %s\n", path);
+        return -1;
+    }
+
+    int result = BrailleImage_Read(image, stream);
+    fclose(stream);
+    return result;
+}
+
+int BrailleImage_Read(BrailleImage* image, FILE* stream)
+{
+    BrailleImageReader reader = {NULL, 0, 0, stream};
+    if (BrailleImage_ParseHeader(image, &reader, "BrailleImage_Read") != 0)
+        return -1;
+
+    size_t size = image->Stride * image->Height;
+    if (size > image->BufferSize)
+    {
+        uint8_t* buffer = (uint8_t*)realloc(image->Buffer, size);
+        if (!buffer)
+        {
+            fprintf(stderr, "BrailleImage_Read: unable to allocate %zu bytes\n", size);
+            return -1;
+        }
+
+        image->Buffer = buffer;
+        image->BufferSize = size;
+    }
+
+    if (fread(image->Buffer, 1, size, stream) != size)
+    {
+        fprintf(stderr, "BrailleImage_Read: the image is truncated\n");
+        return -1;
+    }
+
+    image->Data = image->Buffer;
+    return 0;
+}
+
+void BrailleImage_Destroy(BrailleImage* image)
+{
+    #if BRAILLE_IMAGE_MMAP
+    if (image->Mapping)
+        munmap(image->Mapping, image->MappingSize);
+    #endif
+
+    free(image->Buffer);
+    memset(image, 0, sizeof(BrailleImage));
+}
+
+// DRAWING
+// the area is split in bands of whole cell rows, so no two threads write the same byte of a packed canvas
+//===========================================================================================
+typedef struct
+{
+    const BrailleImage* Image;
+    BrailleCanvas* Canvas;
+    BrailleDither Dither;
+    uint8_t Threshold;
+
+    // the image is drawn on X..X+Width-1, Y..Y+Height-1, of which Left..Right-1, Top..Bottom-1 are inside the clip rectangle
+    int32_t X, Y, Width, Height;
+    int32_t Left, Right, Top, Bottom;
+
+    // source columns averaged into each canvas column Left..Right-1
+    const int32_t* ColumnStart;
+    const int32_t* ColumnEnd;
+} BrailleImageJob;
+
+typedef struct
+{
+    const BrailleImageJob* Job;
+    int32_t Top; // canvas rows of the band
+    int32_t Bottom;
+} BrailleImageBand;
+
+// brightness of one sample
+static inline uint32_t BrailleImage_Luma(const BrailleImage* image, const uint8_t* sample)
+{
+    if (image->Channels == 1)
+        return sample[0];
+
+    return (77u*sample[0] + 150u*sample[1] + 29u*sample[2]) >> 8;
+}
+
+// gray levels (0-255) of canvas row "y", columns Left..Right-1: the average of the source samples each pixel covers
+static void BrailleImage_GrayRow(const BrailleImageJob* job, int32_t y, uint32_t* sums, uint8_t* gray)
+{
+    const BrailleImage* image = job->Image;
+    int64_t v = y - job->Y;
+    int32_t rowStart = (int32_t)(v * image->Height / job->Height);
+    int32_t rowEnd = max((int32_t)((v + 1) * image->Height / job->Height), rowStart + 1);
+
+    // column sums over the source rows, for the source columns in use
+    int32_t first = job->ColumnStart[0], last = job->ColumnEnd[job->Right - job->Left - 1];
+    memset(sums, 0, (size_t)(last - first) * sizeof(uint32_t));
+
+    for (int32_t row = rowStart; row < rowEnd; row++)
+    {
+        const uint8_t* sample = image->Data + (size_t)row * image->Stride + (size_t)first * image->Channels;
+        for (int32_t column = 0; column < last - first; column++, sample += image->Channels)
+            sums[column] += BrailleImage_Luma(image, sample);
+    }
+
+    for (int32_t i = 0; i < job->Right - job->Left; i++)
+    {
+        uint64_t sum = 0;
+        for (int32_t column = job->ColumnStart[i]; column < job->ColumnEnd[i]; column++)
+            sum += sums[column - first];
+
+        uint64_t count = (uint64_t)(job->ColumnEnd[i] - job->ColumnStart[i]) * (rowEnd - rowStart) * image->Maximum;
+        gray[i] = (uint8_t)min(sum * 255 / count, 255);
+    }
+}
+
+// sets or clears the pixels of canvas row "y", columns Left..Right-1
+static void BrailleImage_WriteRow(const BrailleImageJob* job, int32_t y, const uint8_t* bits)
+{
+    BrailleCanvas* canvas = job->Canvas;
+    int32_t count = job->Right - job->Left;
+
+    if (canvas->Storage == BRAILLE_STORAGE_PIXELS)
+    {
+        memcpy(canvas->PixelBuffer + (size_t)job->Left + (size_t)y * canvas->PixelsWidth, bits, count);
+        return;
+    }
+
+    uint8_t* cells = canvas->PixelBuffer + (size_t)(y / BRAILLE_PIXELS_HEIGHT) * canvas->CharacterWidth;
+    const uint32_t* masks = UNICODE_BRAILLE_PATTERN[y % BRAILLE_PIXELS_HEIGHT];
+    for (int32_t i = 0, x = job->Left; i < count; i++, x++)
+    {
+        uint8_t mask = (uint8_t)masks[x % BRAILLE_PIXELS_WIDTH];
+        if (bits[i])
+            cells[x / BRAILLE_PIXELS_WIDTH] |= mask;
+        else
+            cells[x / BRAILLE_PIXELS_WIDTH] &= ~mask;
+    }
+}
+
+// threshold and ordered dithering: every pixel is decided alone
+static void* BrailleImage_DrawBand(void* arg)
+{
+    BrailleImageBand* band = (BrailleImageBand*)arg;
+    const BrailleImageJob* job = band->Job;
+    int32_t count = job->Right - job->Left;
+
+    uint32_t* sums = (uint32_t*)malloc((size_t)(job->ColumnEnd[count - 1] - job->ColumnStart[0]) * sizeof(uint32_t));
+    uint8_t* gray = (uint8_t*)malloc((size_t)count * 2);
+    if (!sums || !gray)
+    {
+        fprintf(stderr, "BrailleImage_Draw: unable to allocate a band\n");
+        free(sums);
+        free(gray);
+        return NULL;
+    }
+
+    uint8_t* bits = gray + count;
+    for (int32_t y = band->Top; y < band->Bottom; y++)
+    {
+        BrailleImage_GrayRow(job, y, sums, gray);
+
+        if (job->Dither == BRAILLE_DITHER_ORDERED)
+        {
+            const uint8_t* bayer = BAYER_8X8[y & 7];
+            for (int32_t i = 0, x = job->Left; i < count; i++, x++)
+                bits[i] = gray[i] > bayer[x & 7]*4 + 2;
+        }
+        else
+        {
+            for (int32_t i = 0; i < count; i++)
+                bits[i] = gray[i] > job->Threshold;
+        }
+
+        BrailleImage_WriteRow(job, y, bits);
+    }
+
+    free(sums);
+    free(gray);
+    return NULL;
+}
+
+// Floyd-Steinberg: the error of each pixel goes to the pixels right and below, so the rows are done in order
+static void BrailleImage_DrawDiffused(const BrailleImageJob* job)
+{
+    int32_t count = job->Right - job->Left;
+
+    uint32_t* sums = (uint32_t*)malloc((size_t)(job->ColumnEnd[count - 1] - job->ColumnStart[0]) * sizeof(uint32_t));
+    uint8_t* gray = (uint8_t*)malloc((size_t)count * 2);
+    int16_t* errors = (int16_t*)calloc((size_t)(count + 2) * 2, sizeof(int16_t)); // this row and the next, with a guard on both sides
+    if (!sums || !gray || !errors)
+    {
+        fprintf(stderr, "BrailleImage_Draw: unable to allocate the error rows\n");
+        free(sums);
+        free(gray);
+        free(errors);
+        return;
+    }
+
+    uint8_t* bits = gray + count;
+    int16_t* current = errors + 1;
+    int16_t* next = errors + count + 3;
+
+    for (int32_t y = job->Top; y < job->Bottom; y++)
+    {
+        BrailleImage_GrayRow(job, y, sums, gray);
+        memset(next - 1, 0, (size_t)(count + 2) * sizeof(int16_t));
+
+        for (int32_t i = 0; i < count; i++)
+        {
+            int32_t level = gray[i] + current[i];
+            bits[i] = level >= 128;
+
+            int32_t error = level - (bits[i] ? 255 : 0);
+            current[i + 1] += (int16_t)(error * 7 / 16);
+            next[i - 1] += (int16_t)(error * 3 / 16);
+            next[i] += (int16_t)(error * 5 / 16);
+            next[i + 1] += (int16_t)(error / 16);
+        }
+
+        BrailleImage_WriteRow(job, y, bits);
+
+        int16_t* swap = current;
+        current = next;
+        next = swap;
+    }
+
+    free(sums);
+    free(gray);
+    free(errors);
+}
+
+void BrailleImage_Draw(const BrailleImage* image, BrailleCanvas* canvas, int32_t x, int32_t y, int32_t width, int32_t height, BrailleDither dither, uint8_t threshold, uint8_t threads)
+{
+    BrailleCanvas_Flush(canvas); // queued drawing happened before
+
+    if (!image->Data || width <= 0 || height <= 0)
+        return;
+
+    BrailleImageJob job;
+    memset(&job, 0, sizeof(job));
+    job.Image = image;
+    job.Canvas = canvas;
+    job.Dither = dither;
+    job.Threshold = threshold;
+    job.X = x;
+    job.Y = y;
+    job.Width = width;
+    job.Height = height;
+    job.Left = (int32_t)max((int64_t)x, (int64_t)canvas->Clip.Left*BRAILLE_PIXELS_WIDTH);
+    job.Top = (int32_t)max((int64_t)y, (int64_t)canvas->Clip.Top*BRAILLE_PIXELS_HEIGHT);
+    job.Right = (int32_t)min((int64_t)x + width, (int64_t)canvas->Clip.Right*BRAILLE_PIXELS_WIDTH);
+    job.Bottom = (int32_t)min((int64_t)y + height, (int64_t)canvas->Clip.Bottom*BRAILLE_PIXELS_HEIGHT);
+
+    if (job.Right <= job.Left || job.Bottom <= job.Top)
+        return;
+
+    int32_t count = job.Right - job.Left;
+    int32_t* columns = (int32_t*)malloc((size_t)count * 2 * sizeof(int32_t));
+    if (!columns)
+    {
+        fprintf(stderr, "BrailleImage_Draw: unable to allocate %d columns\n", count);
+        return;
+    }
+
+    for (int32_t i = 0; i < count; i++)
+    {
+        int64_t u = job.Left + i - (int64_t)x;
+        columns[i] = (int32_t)(u * image->Width / width);
+        columns[count + i] = max((int32_t)((u + 1) * image->Width / width), columns[i] + 1);
+    }
+
+    job.ColumnStart = columns;
+    job.ColumnEnd = columns + count;
+
+    if (dither == BRAILLE_DITHER_FLOYD_STEINBERG)
+        BrailleImage_DrawDiffused(&job);
+    else
+    {
+        // bands of whole cell rows, one per thread - this thread draws the first one
+        int32_t firstRow = job.Top / BRAILLE_PIXELS_HEIGHT;
+        int32_t rows = (job.Bottom - 1) / BRAILLE_PIXELS_HEIGHT + 1 - firstRow;
+        int32_t bandCount = max(min((int32_t)threads, rows), 1);
+
+        BrailleImageBand* bands = (BrailleImageBand*)malloc(bandCount * sizeof(BrailleImageBand));
+        pthread_t* helpers = (pthread_t*)malloc(bandCount * sizeof(pthread_t));
+        uint8_t* started = (uint8_t*)calloc(bandCount, 1);
+        if (!bands || !helpers || !started)
+            bandCount = 1;
+
+        BrailleImageBand single;
+        if (bandCount == 1)
+        {
+            single = (BrailleImageBand){&job, job.Top, job.Bottom};
+            BrailleImage_DrawBand(&single);
+        }
+        else
+        {
+            for (int32_t b = 0; b < bandCount; b++)
+            {
+                bands[b].Job = &job;
+                bands[b].Top = max((firstRow + rows * b / bandCount) * BRAILLE_PIXELS_HEIGHT, job.Top);
+                bands[b].Bottom = min((firstRow + rows * (b + 1) / bandCount) * BRAILLE_PIXELS_HEIGHT, job.Bottom);
+            }
+
+            for (int32_t b = 1; b < bandCount; b++)
+                started[b] = pthread_create(&helpers[b], NULL, BrailleImage_DrawBand, &bands[b]) == 0;
+
+            BrailleImage_DrawBand(&bands[0]);
+
+            for (int32_t b = 1; b < bandCount; b++)
+            {
+                if (started[b])
+                    pthread_join(helpers[b], NULL);
+                else
+                    BrailleImage_DrawBand(&bands[b]); // no thread for it: drawn here
+            }
+        }
+
+        free(bands);
+        free(helpers);
+        free(started);
+    }
+
+    free(columns);
+
+    // every cell under the image was written
+    if (canvas->StylePlane)
+        for (int32_t row = job.Top / BRAILLE_PIXELS_HEIGHT; row <= (job.Bottom - 1) / BRAILLE_PIXELS_HEIGHT; row++)
+            for (int32_t column = job.Left / BRAILLE_PIXELS_WIDTH; column <= (job.Right - 1) / BRAILLE_PIXELS_WIDTH; column++)
+                canvas->StylePlane[column + (size_t)row * canvas->CharacterWidth] = canvas->Pen;
+
+    BrailleCanvas_MarkDirty(canvas, job.Left, job.Top, job.Right - job.Left, job.Bottom - job.Top);
+}
@@ -0,0 +1,61 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+#ifndef _BRAILLE_IMAGE_H_
+#define _BRAILLE_IMAGE_H_
+
+#include <stdio.h>
+#include "braillecanvas.h"
+
+typedef enum {
+    BRAILLE_DITHER_THRESHOLD = 0, // pixels brighter than the threshold are set
+    BRAILLE_DITHER_ORDERED = 1, // 8x8 Bayer matrix, aligned to the canvas so it doesn't crawl when the image moves
+    BRAILLE_DITHER_FLOYD_STEINBERG = 2, // error diffusion - finer, but always on one thread
+} BrailleDither;
+
+// an 8-bit grayscale or RGB raster: a file mapped in memory, a frame read from a stream, or a buffer owned by the caller
+typedef struct
+{
+    const uint8_t* Data;
+    int32_t Width;
+    int32_t Height;
+    size_t Stride; // bytes from one row to the next
+    uint8_t Channels; // 1: gray, 3: RGB (drawn by its luma)
+    uint8_t Maximum; // sample value of white
+
+    // storage, when the image owns it
+    void* Mapping;
+    size_t MappingSize;
+    uint8_t* Buffer;
+    size_t BufferSize;
+} BrailleImage;
+
+// wraps a raster owned by the caller, without copying it
+int BrailleImage_Wrap(BrailleImage*, const uint8_t* data, int32_t width, int32_t height, size_t stride, uint8_t channels);
+
+// binary PGM (P5) or PPM (P6) with 8-bit samples
+// Load maps the file in memory when it can; Read takes the next image of a stream (pipes of frames, one after the other)
+// and reuses the buffer of the previous one - initialize the image with zeros before the first Read
+// return 0 on success (Read returns -1 without a message at the end of the stream)
+int BrailleImage_Load(BrailleImage*, const char* path);
+int BrailleImage_Read(BrailleImage*, FILE*);
+void BrailleImage_Destroy(BrailleImage*);
+
+// scales the image to width x height pixels with its top-left corner at x, y, and replaces the pixels there (inside the clip rectangle)
+// "threshold" is used by BRAILLE_DITHER_THRESHOLD; "threads" is the number of row bands dithered in parallel (not by Floyd-Steinberg)
+void BrailleImage_Draw(const BrailleImage*, BrailleCanvas*, int32_t x, int32_t y, int32_t width, int32_t height, BrailleDither, uint8_t threshold, uint8_t threads);
+
+#endif // _BRAILLE_IMAGE_H_
@@ -0,0 +1,566 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+#include "braillerecorder.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(WIN32) || defined(_WIN32) || defined(__WIN32) || defined(__WIN32__))
+    #include <windows.h>
+    #define BRAILLE_RECORDER_MMAP 0
+    static uint64_t NOWUS() { LARGE_INTEGER f, t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t); return (uint64_t)(t.QuadPart * (1e6 / f.QuadPart)); }
+    static void SLEEPUS(uint64_t us) { Sleep((DWORD)(us / 1000)); }
+#else
+    #define BRAILLE_RECORDER_MMAP 1
+    #include <fcntl.h>
+    #include <time.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    static uint64_t NOWUS() { struct timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return (uint64_t)t.tv_sec*1000000 + t.tv_nsec/1000; }
+    static void SLEEPUS(uint64_t us) { struct timespec t = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 }; nanosleep(&t, NULL); }
+#endif
+
+#define RECORD_MAGIC "BRLREC01"
+#define RECORD_MAGIC_SIZE 8
+#define RECORD_HEADER_SIZE 16
+#define RECORD_KEYFRAME 1
+#define RECORD_CHANGES 2
+#define RECORD_COLORS 0x01
+#define RECORD_RUN_HEADER 6
+#define RECORD_COLOR_SIZE 8
+
+// unchanged cells between two changed ones are stored when there are fewer than this: cheaper than the header of a new run
+#define RECORD_MIN_GAP 4
+
+#define sameStyle(a,b) ((a).Foreground == (b).Foreground && (a).Background == (b).Background)
+
+// little-endian numbers
+//===========================================================================================
+static void put16(uint8_t* out, uint16_t value) { out[0] = value; out[1] = value >> 8; }
+static void put32(uint8_t* out, uint32_t value) { put16(out, value); put16(out + 2, value >> 16); }
+static void put64(uint8_t* out, uint64_t value) { put32(out, value); put32(out + 4, value >> 32); }
+static uint16_t get16(const uint8_t* in) { return in[0] | (uint16_t)in[1] << 8; }
+static uint32_t get32(const uint8_t* in) { return get16(in) | (uint32_t)get16(in + 2) << 16; }
+static uint64_t get64(const uint8_t* in) { return get32(in) | (uint64_t)get32(in + 4) << 32; }
+//===========================================================================================
+
+// RECORDER
+//===========================================================================================
+int BrailleRecorder_Create(BrailleRecorder* recorder, const char* path, uint32_t keyframeInterval)
+{
+    memset(recorder, 0, sizeof(BrailleRecorder));
+
+    recorder->File = fopen(path, "wb");
+    if (!recorder->File)
+    {
+        fprintf(stderr, "BrailleRecorder_Create: unable to create %s\n", path);
+        return -1;
+    }
+
+    if (fwrite(RECORD_MAGIC, 1, RECORD_MAGIC_SIZE, recorder->File) != RECORD_MAGIC_SIZE)
+    {
+        fprintf(stderr, "BrailleRecorder_Create: unable to write %s\n", path);
+        fclose(recorder->File);
+        recorder->File = NULL;
+        return -1;
+    }
+
+    recorder->KeyframeInterval = max(keyframeInterval, 1);
+    recorder->Bytes = RECORD_MAGIC_SIZE;
+    recorder->Start = NOWUS();
+    return 0;
+}
+
+void BrailleRecorder_Close(BrailleRecorder* recorder)
+{
+    if (recorder->File)
+        fclose(recorder->File);
+
+    free(recorder->Patterns);
+    free(recorder->Styles);
+    free(recorder->Record);
+    memset(recorder, 0, sizeof(BrailleRecorder));
+}
+
+// makes room for "size" more bytes at the end of the record being built and returns them
+static uint8_t* BrailleRecorder_Append(BrailleRecorder* recorder, size_t size)
+{
+    if (recorder->RecordLength + size > recorder->RecordCapacity)
+    {
+        size_t capacity = max(2 * recorder->RecordCapacity, recorder->RecordLength + size);
+        uint8_t* grown = (uint8_t*)realloc(recorder->Record, capacity);
+        if (!grown)
+            return NULL;
+
+        recorder->Record = grown;
+        recorder->RecordCapacity = capacity;
+    }
+
+    uint8_t* out = &recorder->Record[recorder->RecordLength];
+    recorder->RecordLength += size;
+    return out;
+}
+
+// appends the patterns, then the colors, of "count" cells
+static int BrailleRecorder_AppendCells(BrailleRecorder* recorder, const uint8_t* patterns, const BrailleCellStyle* styles, uint32_t count)
+{
+    uint8_t* out = BrailleRecorder_Append(recorder, count * (1 + (styles ? RECORD_COLOR_SIZE : 0)));
+    if (!out)
+        return -1;
+
+    memcpy(out, patterns, count);
+    out += count;
+
+    if (styles)
+        for (uint32_t i = 0; i < count; i++, out += RECORD_COLOR_SIZE)
+        {
+            put32(out, styles[i].Foreground);
+            put32(out + 4, styles[i].Background);
+        }
+
+    return 0;
+}
+
+int BrailleRecorder_Capture(BrailleRecorder* recorder, BrailleCanvas* canvas)
+{
+    return BrailleRecorder_CaptureAt(recorder, canvas, NOWUS() - recorder->Start);
+}
+
+// the record is built in memory and written in one go, so a recording cut short loses at most its last record
+int BrailleRecorder_CaptureAt(BrailleRecorder* recorder, BrailleCanvas* canvas, uint64_t microseconds)
+{
+    if (!recorder->File)
+        return -1;
+
+    BrailleCanvas_Flush(canvas);
+
+    uint16_t width = canvas->ViewWidth;
+    uint16_t height = canvas->ViewHeight;
+    uint8_t colors = canvas->StylePlane != NULL;
+
+    // a change of size or of colors needs a keyframe too
+    uint8_t keyframe = recorder->Records % recorder->KeyframeInterval == 0 ||
+                       width != recorder->Width || height != recorder->Height || colors != (recorder->Styles != NULL);
+
+    if (width != recorder->Width || height != recorder->Height || colors != (recorder->Styles != NULL))
+    {
+        free(recorder->Patterns);
+        free(recorder->Styles);
+        recorder->Patterns = (uint8_t*)calloc((size_t)width * height + 1, sizeof(uint8_t));
+        recorder->Styles = colors ? (BrailleCellStyle*)calloc((size_t)width * height + 1, sizeof(BrailleCellStyle)) : NULL;
+        recorder->Width = width;
+        recorder->Height = height;
+
+        if (!recorder->Patterns || (colors && !recorder->Styles))
+        {
+            fprintf(stderr, "BrailleRecorder_Capture: frame allocation has failed\n");
+            free(recorder->Patterns);
+            free(recorder->Styles);
+            recorder->Patterns = NULL;
+            recorder->Styles = NULL;
+            recorder->Width = recorder->Height = 0;
+            return -1;
+        }
+    }
+
+    recorder->RecordLength = 0;
+    uint8_t* header = BrailleRecorder_Append(recorder, RECORD_HEADER_SIZE + (keyframe ? 4 : 0));
+    if (!header)
+    {
+        fprintf(stderr, "BrailleRecorder_Capture: record allocation has failed\n");
+        return -1;
+    }
+
+    header[0] = keyframe ? RECORD_KEYFRAME : RECORD_CHANGES;
+    header[1] = colors ? RECORD_COLORS : 0;
+    header[2] = (uint8_t)canvas->FillStyle;
+    header[3] = (uint8_t)canvas->BackgroundStyle;
+    put64(header + 4, microseconds);
+
+    if (keyframe)
+    {
+        put16(header + RECORD_HEADER_SIZE, width);
+        put16(header + RECORD_HEADER_SIZE + 2, height);
+    }
+
+    uint8_t styled = canvas->FillStyle != recorder->FillStyle || canvas->BackgroundStyle != recorder->BackgroundStyle;
+    recorder->FillStyle = canvas->FillStyle;
+    recorder->BackgroundStyle = canvas->BackgroundStyle;
+
+    uint8_t patterns[width + 1];
+    uint8_t failed = 0;
+
+    for (uint16_t row = 0; row < height && !failed; row++)
+    {
+        uint8_t* last = &recorder->Patterns[(size_t)row * width];
+        BrailleCellStyle* lastStyles = colors ? &recorder->Styles[(size_t)row * width] : NULL;
+        const BrailleCellStyle* styles = colors ? &canvas->StylePlane[canvas->ViewColumn + (size_t)(canvas->ViewRow + row) * canvas->CharacterWidth] : NULL;
+
+        BrailleCanvas_PackRow(canvas, canvas->ViewRow + row, canvas->ViewColumn, width, patterns);
+
+        if (keyframe)
+            failed = BrailleRecorder_AppendCells(recorder, patterns, styles, width) != 0;
+        else
+        {
+            #define cellChanged(c) (patterns[c] != last[c] || (styles && !sameStyle(styles[c], lastStyles[c])))
+
+            uint16_t col = 0;
+            while (col < width && !failed)
+            {
+                if (!cellChanged(col))
+                {
+                    col++;
+                    continue;
+                }
+
+                // the run ends at the first RECORD_MIN_GAP unchanged cells in a row
+                uint16_t end = col + 1;
+                for (uint16_t c = end; c < width && c - end < RECORD_MIN_GAP; c++)
+                    if (cellChanged(c))
+                        end = c + 1;
+
+                uint8_t* run = BrailleRecorder_Append(recorder, RECORD_RUN_HEADER);
+                failed = !run;
+                if (run)
+                {
+                    put16(run, row);
+                    put16(run + 2, col);
+                    put16(run + 4, end - col);
+                    failed = BrailleRecorder_AppendCells(recorder, &patterns[col], styles ? &styles[col] : NULL, end - col) != 0;
+                }
+
+                col = end;
+            }
+
+            #undef cellChanged
+        }
+
+        memcpy(last, patterns, width);
+        if (colors)
+            memcpy(lastStyles, styles, width * sizeof(BrailleCellStyle));
+    }
+
+    if (failed)
+    {
+        fprintf(stderr, "BrailleRecorder_Capture: record allocation has failed\n");
+        recorder->Width = recorder->Height = 0; // the next frame is a keyframe
+        return -1;
+    }
+
+    if (!keyframe && !styled && recorder->RecordLength == RECORD_HEADER_SIZE)
+        return 0; // nothing changed
+
+    put32(recorder->Record + 12, (uint32_t)(recorder->RecordLength - RECORD_HEADER_SIZE));
+
+    if (fwrite(recorder->Record, 1, recorder->RecordLength, recorder->File) != recorder->RecordLength)
+    {
+        fprintf(stderr, "BrailleRecorder_Capture: unable to write the record\n");
+        return -1;
+    }
+
+    recorder->Records++;
+    recorder->Bytes += recorder->RecordLength;
+    return 0;
+}
+//===========================================================================================
+
+// PLAYER
+//===========================================================================================
+int BraillePlayer_Open(BraillePlayer* player, const char* path)
+{
+    memset(player, 0, sizeof(BraillePlayer));
+
+    #if BRAILLE_RECORDER_MMAP
+    int file = open(path, O_RDONLY);
+    if (file >= 0)
+    {
+        struct stat info;
+        void* mapping = MAP_FAILED;
+        if (fstat(file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+            mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+        close(file);
+
+        if (mapping != MAP_FAILED)
+        {
+            player->Mapping = mapping;
+            player->Data = (const uint8_t*)mapping;
+            player->Size = (size_t)info.st_size;
+        }
+    }
+    #endif
+
+    if (!player->Data) // no mapping: read in memory
+    {
+        FILE* stream = fopen(path, "rb");
+        if (!stream)
+        {
+            fprintf(stderr, "BraillePlayer_Open: unable to open %s\n", path);
+            return -1;
+        }
+
+        size_t capacity = 0;
+        for (;;)
+        {
+            if (player->Size == capacity)
+            {
+                capacity = max(2 * capacity, 1 << 16);
+                uint8_t* grown = (uint8_t*)realloc(player->Buffer, capacity);
+                if (!grown)
+                {
+                    fprintf(stderr, "BraillePlayer_Open: allocation has failed\n");
+                    fclose(stream);
+                    BraillePlayer_Close(player);
+                    return -1;
+                }
+
+                player->Buffer = grown;
+            }
+
+            size_t read = fread(player->Buffer + player->Size, 1, capacity - player->Size, stream);
+            if (read == 0)
+                break;
+
+            player->Size += read;
+        }
+
+        fclose(stream);
+        player->Data = player->Buffer;
+    }
+
+    if (player->Size < RECORD_MAGIC_SIZE || memcmp(player->Data, RECORD_MAGIC, RECORD_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "BraillePlayer_Open: %s is not a recording\n", path);
+        BraillePlayer_Close(player);
+        return -1;
+    }
+
+    // index the records - a truncated one ends the recording
+    uint32_t capacity = 0;
+    size_t offset = RECORD_MAGIC_SIZE;
+    while (player->Size - offset >= RECORD_HEADER_SIZE)
+    {
+        const uint8_t* record = player->Data + offset;
+        size_t size = RECORD_HEADER_SIZE + (size_t)get32(record + 12);
+        if (player->Size - offset < size || (record[0] != RECORD_KEYFRAME && record[0] != RECORD_CHANGES))
+            break;
+
+        if (player->Records == capacity)
+        {
+            capacity = max(2 * capacity, 256);
+            size_t* grown = (size_t*)realloc(player->Offsets, capacity * sizeof(size_t));
+            if (!grown)
+            {
+                fprintf(stderr, "BraillePlayer_Open: allocation has failed\n");
+                BraillePlayer_Close(player);
+                return -1;
+            }
+
+            player->Offsets = grown;
+        }
+
+        player->Offsets[player->Records++] = offset;
+        offset += size;
+    }
+
+    if (player->Records == 0 || player->Data[player->Offsets[0]] != RECORD_KEYFRAME)
+    {
+        fprintf(stderr, "BraillePlayer_Open: %s has no frames\n", path);
+        BraillePlayer_Close(player);
+        return -1;
+    }
+
+    return 0;
+}
+
+void BraillePlayer_Close(BraillePlayer* player)
+{
+    #if BRAILLE_RECORDER_MMAP
+    if (player->Mapping)
+        munmap(player->Mapping, player->Size);
+    #endif
+
+    free(player->Buffer);
+    free(player->Offsets);
+    memset(player, 0, sizeof(BraillePlayer));
+}
+
+uint64_t BraillePlayer_GetTime(const BraillePlayer* player, uint32_t record)
+{
+    return record < player->Records ? get64(player->Data + player->Offsets[record] + 4) : 0;
+}
+
+uint32_t BraillePlayer_Find(const BraillePlayer* player, uint64_t microseconds)
+{
+    // the last record at or before that time
+    uint32_t low = 0, high = player->Records;
+    while (high - low > 1)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (BraillePlayer_GetTime(player, middle) <= microseconds)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+// copies the patterns, then the colors, of "count" cells of the record to the window of the canvas
+static void BraillePlayer_DrawCells(BrailleCanvas* canvas, uint16_t row, uint16_t col, uint16_t count, const uint8_t* cells, uint8_t colors)
+{
+    BrailleCanvas_UnpackRow(canvas, canvas->ViewRow + row, canvas->ViewColumn + col, count, cells);
+
+    if (!canvas->StylePlane)
+        return;
+
+    BrailleCellStyle* styles = &canvas->StylePlane[canvas->ViewColumn + col + (size_t)(canvas->ViewRow + row) * canvas->CharacterWidth];
+    const uint8_t* in = cells + count;
+    for (uint16_t i = 0; i < count; i++, in += RECORD_COLOR_SIZE)
+        styles[i] = colors ? (BrailleCellStyle){get32(in), get32(in + 4)} : (BrailleCellStyle){TERMINAL_COLOR_DEFAULT, TERMINAL_COLOR_DEFAULT};
+}
+
+// draws one record on the canvas - returns 0 on success
+static int BraillePlayer_Draw(BraillePlayer* player, BrailleCanvas* canvas, uint32_t index)
+{
+    const uint8_t* record = player->Data + player->Offsets[index];
+    const uint8_t* payload = record + RECORD_HEADER_SIZE;
+    size_t size = get32(record + 12);
+    uint8_t colors = record[1] & RECORD_COLORS;
+    size_t cellSize = 1 + (colors ? RECORD_COLOR_SIZE : 0);
+
+    if (record[0] == RECORD_KEYFRAME)
+    {
+        uint16_t width = size >= 4 ? get16(payload) : 0;
+        uint16_t height = size >= 4 ? get16(payload + 2) : 0;
+        if (size != 4 + (size_t)width * height * cellSize)
+        {
+            fprintf(stderr, "BraillePlayer: record %u is damaged\n", index);
+            return -1;
+        }
+
+        if (canvas->ViewWidth != width || canvas->ViewHeight != height)
+        {
+            BrailleCanvas_Resize(canvas, width, height);
+            BrailleCanvas_SetView(canvas, 0, 0, width, height);
+        }
+
+        if (colors && !canvas->StylePlane)
+            BrailleCanvas_EnableStylePlane(canvas);
+
+        player->Width = width;
+        player->Height = height;
+
+        for (uint16_t row = 0; row < height; row++)
+            BraillePlayer_DrawCells(canvas, row, 0, width, payload + 4 + (size_t)row * width * cellSize, colors);
+    }
+    else
+    {
+        if (player->Width == 0 || canvas->ViewWidth != player->Width || canvas->ViewHeight != player->Height)
+        {
+            fprintf(stderr, "BraillePlayer: record %u does not follow its keyframe\n", index);
+            return -1;
+        }
+
+        if (colors && !canvas->StylePlane)
+            BrailleCanvas_EnableStylePlane(canvas);
+
+        size_t position = 0;
+        while (position < size)
+        {
+            const uint8_t* run = payload + position;
+            uint16_t row = size - position >= RECORD_RUN_HEADER ? get16(run) : UINT16_MAX;
+            uint16_t col = size - position >= RECORD_RUN_HEADER ? get16(run + 2) : 0;
+            uint16_t count = size - position >= RECORD_RUN_HEADER ? get16(run + 4) : 0;
+
+            position += RECORD_RUN_HEADER + count * cellSize;
+            if (row >= player->Height || col + count > player->Width || position > size)
+            {
+                fprintf(stderr, "BraillePlayer: record %u is damaged\n", index);
+                return -1;
+            }
+
+            BraillePlayer_DrawCells(canvas, row, col, count, run + RECORD_RUN_HEADER, colors);
+        }
+    }
+
+    canvas->FillStyle = (ConsoleStyleText)record[2];
+    canvas->BackgroundStyle = (ConsoleStyleBackground)record[3];
+
+    return 0;
+}
+
+int BraillePlayer_Seek(BraillePlayer* player, BrailleCanvas* canvas, uint32_t record)
+{
+    if (record >= player->Records)
+        return -1;
+
+    uint32_t keyframe = record;
+    while (player->Data[player->Offsets[keyframe]] != RECORD_KEYFRAME) // the first record is a keyframe
+        keyframe--;
+
+    for (player->Position = keyframe; player->Position <= record; player->Position++)
+        if (BraillePlayer_Draw(player, canvas, player->Position) != 0)
+            return -1;
+
+    return 0;
+}
+
+int BraillePlayer_Step(BraillePlayer* player, BrailleCanvas* canvas)
+{
+    if (player->Position >= player->Records)
+        return -1;
+
+    return BraillePlayer_Draw(player, canvas, player->Position++);
+}
+
+int BraillePlayer_Play(BraillePlayer* player, BrailleCanvas* canvas, double speed)
+{
+    if (player->Position >= player->Records)
+        return -1;
+
+    uint64_t first = BraillePlayer_GetTime(player, player->Position);
+    uint64_t start = NOWUS();
+
+    // when a record is due, on the clock of the player
+    #define dueTime(record) (start + (uint64_t)((max(BraillePlayer_GetTime(player, record), first) - first) / speed))
+
+    while (player->Position < player->Records)
+    {
+        if (speed > 0)
+        {
+            uint64_t due = dueTime(player->Position);
+            uint64_t now = NOWUS();
+            if (now < due)
+                SLEEPUS(due - now);
+        }
+
+        if (BraillePlayer_Step(player, canvas) != 0)
+            return -1;
+
+        // the next record is due already: print that one instead
+        if (speed > 0 && player->Position < player->Records && NOWUS() >= dueTime(player->Position))
+            continue;
+
+        BrailleCanvas_RenderDiff(canvas, NULL);
+    }
+
+    #undef dueTime
+
+    return 0;
+}
+//===========================================================================================
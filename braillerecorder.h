@@ -0,0 +1,99 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+#ifndef _BRAILLE_RECORDER_H_
+#define _BRAILLE_RECORDER_H_
+
+#include <stdio.h>
+#include "braillecanvas.h"
+
+// RECORDINGS
+// a file of the frames a canvas showed: each record holds the cells (braille patterns and colors) that changed since the
+// record before it, and every KeyframeInterval records a keyframe holds them all, so a player can start anywhere
+//
+// file: "BRLREC01", then the records, each made of a 16-byte header and its payload (all numbers little-endian)
+//   uint8 kind (1: keyframe, 2: changes)   uint8 flags (1: with colors)   uint8 fill style   uint8 background style
+//   uint64 time (microseconds since the recording started)   uint32 payload size
+// keyframe payload: uint16 width, uint16 height (cells), then every row - its patterns, then its color pairs
+// changes payload: runs of a row - uint16 row, uint16 column, uint16 length, the patterns, then the color pairs
+// a color pair is two uint32: foreground and background
+//===========================================================================================
+typedef struct
+{
+    FILE* File;
+    uint32_t KeyframeInterval; // records from one keyframe to the next
+    uint32_t Records; // written so far
+    uint64_t Bytes;
+    uint64_t Start; // clock when the recording started, in microseconds
+
+    // the frame recorded last
+    uint16_t Width;
+    uint16_t Height;
+    uint8_t* Patterns;
+    BrailleCellStyle* Styles; // NULL: the canvas had no colors
+    ConsoleStyleText FillStyle;
+    ConsoleStyleBackground BackgroundStyle;
+
+    // the record being built
+    uint8_t* Record;
+    size_t RecordLength;
+    size_t RecordCapacity;
+} BrailleRecorder;
+
+// returns 0 on success
+int BrailleRecorder_Create(BrailleRecorder*, const char* path, uint32_t keyframeInterval);
+void BrailleRecorder_Close(BrailleRecorder*);
+
+// records the window of the canvas as it is now (call it after every render) - a frame with no change is not written
+// returns 0 on success
+int BrailleRecorder_Capture(BrailleRecorder*, BrailleCanvas*);
+int BrailleRecorder_CaptureAt(BrailleRecorder*, BrailleCanvas*, uint64_t microseconds);
+
+// plays a recording back on a canvas, through the usual renderer - the file is mapped in memory and indexed when it is opened,
+// a record cut short (a recorder that never closed) ends the recording
+typedef struct
+{
+    const uint8_t* Data;
+    size_t Size;
+    void* Mapping;
+    uint8_t* Buffer; // when the file could not be mapped
+
+    size_t* Offsets; // of every record
+    uint32_t Records;
+    uint32_t Position; // the next record to draw
+
+    // size of the frames since the last keyframe drawn
+    uint16_t Width;
+    uint16_t Height;
+} BraillePlayer;
+
+// returns 0 on success
+int BraillePlayer_Open(BraillePlayer*, const char* path);
+void BraillePlayer_Close(BraillePlayer*);
+
+uint64_t BraillePlayer_GetTime(const BraillePlayer*, uint32_t record); // microseconds
+uint32_t BraillePlayer_Find(const BraillePlayer*, uint64_t microseconds); // the record showing at that time
+
+// draw on the canvas (resized to the recorded frames) without printing it - each returns 0 on success, -1 at the end or on a damaged record
+int BraillePlayer_Seek(BraillePlayer*, BrailleCanvas*, uint32_t record); // from the keyframe before it
+int BraillePlayer_Step(BraillePlayer*, BrailleCanvas*); // the next record
+
+// draws and prints the records from the current position to the end, paced by their times divided by "speed"
+// (0: as fast as possible) - when it falls behind, the records already late are drawn but only the latest is printed
+int BraillePlayer_Play(BraillePlayer*, BrailleCanvas*, double speed);
+//===========================================================================================
+
+#endif // _BRAILLE_RECORDER_H_
@@ -0,0 +1,243 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+
+#include "braillerenderthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined(WIN32) || defined(_WIN32) || defined(__WIN32) || defined(__WIN32__))
+    #include <windows.h>
+    static uint64_t NOWMS() { return GetTickCount64(); }
+    static void SLEEPMS(uint32_t ms) { Sleep(ms); }
+#else
+    #include <time.h>
+    #include <unistd.h>
+    static uint64_t NOWMS() { struct timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return (uint64_t)t.tv_sec*1000 + t.tv_nsec/1000000; }
+    static void SLEEPMS(uint32_t ms) { usleep(ms*1000); }
+#endif
+
+// copies the pixels and colors of the window of "canvas" to "frame", a canvas of the size of that window
+static void CopyWindow(BrailleCanvas* frame, BrailleCanvas* canvas)
+{
+    if (canvas->Storage == BRAILLE_STORAGE_PACKED) // one byte per cell
+    {
+        for (uint16_t row = 0; row < frame->CharacterHeight; row++)
+            memcpy(&frame->PixelBuffer[(size_t)row * frame->CharacterWidth],
+                   &canvas->PixelBuffer[canvas->ViewColumn + (size_t)(canvas->ViewRow + row) * canvas->CharacterWidth], frame->CharacterWidth);
+    }
+    else // one byte per pixel
+    {
+        for (int32_t y = 0; y < frame->PixelsHeight; y++)
+            memcpy(&frame->PixelBuffer[(size_t)y * frame->PixelsWidth],
+                   &canvas->PixelBuffer[canvas->ViewColumn*BRAILLE_PIXELS_WIDTH + (size_t)(canvas->ViewRow*BRAILLE_PIXELS_HEIGHT + y) * canvas->PixelsWidth], frame->PixelsWidth);
+    }
+
+    if (frame->StylePlane && canvas->StylePlane)
+        for (uint16_t row = 0; row < frame->CharacterHeight; row++)
+            memcpy(&frame->StylePlane[(size_t)row * frame->CharacterWidth],
+                   &canvas->StylePlane[canvas->ViewColumn + (size_t)(canvas->ViewRow + row) * canvas->CharacterWidth], frame->CharacterWidth * sizeof(BrailleCellStyle));
+}
+
+static void* BrailleRenderThread_Main(void* arg)
+{
+    BrailleRenderThread* renderer = (BrailleRenderThread*)arg;
+    uint32_t frameMs = renderer->MaxFramesPerSecond ? 1000 / renderer->MaxFramesPerSecond : 0;
+
+    BrailleCanvas* canvas = &renderer->Canvas;
+    BrailleCanvas* pending = &renderer->Pending;
+    uint8_t behind = 0; // the terminal was still busy: the last frame taken has not been printed yet
+
+    pthread_mutex_lock(&renderer->Lock);
+    for (;;)
+    {
+        while (!renderer->HasPending && !behind && !renderer->Quit)
+            pthread_cond_wait(&renderer->Wake, &renderer->Lock);
+
+        if (renderer->Quit)
+            break;
+
+        // take the latest frame: swap the buffers, the application fills the other one next time
+        if (renderer->HasPending)
+        {
+            if (behind) // the frame taken last time never got out: its changes go out with this one
+            {
+                renderer->FramesDropped++;
+                Terminal_DropFrame();
+            }
+
+            uint8_t* pixels = canvas->PixelBuffer;
+            canvas->PixelBuffer = pending->PixelBuffer;
+            pending->PixelBuffer = pixels;
+
+            BrailleCellStyle* styles = canvas->StylePlane;
+            canvas->StylePlane = pending->StylePlane;
+            pending->StylePlane = styles;
+
+            canvas->FillStyle = pending->FillStyle;
+            canvas->BackgroundStyle = pending->BackgroundStyle;
+            BrailleRect_Union(&canvas->Dirty, &pending->Dirty); // everything that changed since the last frame printed
+            pending->Dirty = (BrailleRect){0, 0, 0, 0};
+
+            renderer->HasPending = 0;
+        }
+        pthread_mutex_unlock(&renderer->Lock);
+
+        // print it - only this thread waits for the terminal
+        uint64_t start = NOWMS();
+
+        // while the terminal is busy the frame waits here: it is only dropped when a newer one replaces it
+        BrailleRenderStats stats = {0, 0, 1};
+        Terminal_Lock();
+        if (Terminal_Ready())
+            BrailleCanvas_RenderDiff(canvas, &stats);
+        Terminal_Flush();
+        Terminal_Unlock();
+
+        // pacing: don't start the next frame before its time - nor retry a busy terminal right away
+        behind = stats.Dropped;
+        uint32_t waitMs = behind ? max(frameMs, 1) : frameMs;
+        uint64_t elapsed = NOWMS() - start;
+        if (elapsed < waitMs)
+            SLEEPMS(waitMs - elapsed);
+
+        pthread_mutex_lock(&renderer->Lock);
+        if (!behind)
+            renderer->FramesWritten++;
+        renderer->LastFrame = stats;
+    }
+    pthread_mutex_unlock(&renderer->Lock);
+
+    return NULL;
+}
+
+// starts a render thread for canvases with the placement, window size and storage of "layout"
+// the frames only hold the window: virtual canvases are not copied whole
+// returns 0 on success
+int BrailleRenderThread_Start(BrailleRenderThread* renderer, BrailleCanvas* layout, uint16_t maxFramesPerSecond)
+{
+    renderer->Started = 0;
+
+    BrailleCanvas_CreateVirtual(&renderer->Canvas, layout->CharacterLeft, layout->CharacterTop, layout->ViewWidth, layout->ViewHeight, layout->ViewWidth, layout->ViewHeight, layout->Storage);
+    BrailleCanvas_CreateVirtual(&renderer->Pending, layout->CharacterLeft, layout->CharacterTop, layout->ViewWidth, layout->ViewHeight, layout->ViewWidth, layout->ViewHeight, layout->Storage);
+    renderer->ViewColumn = layout->ViewColumn;
+    renderer->ViewRow = layout->ViewRow;
+
+    if (layout->StylePlane)
+    {
+        BrailleCanvas_EnableStylePlane(&renderer->Canvas);
+        BrailleCanvas_EnableStylePlane(&renderer->Pending);
+    }
+
+    // the frames could not be allocated (an empty window has nothing to allocate)
+    if (layout->ViewWidth && layout->ViewHeight && (!renderer->Canvas.PixelBuffer || !renderer->Pending.PixelBuffer ||
+        (layout->StylePlane && (!renderer->Canvas.StylePlane || !renderer->Pending.StylePlane))))
+    {
+        fprintf(stderr, "\nRender thread frame allocation has failed\n");
+        BrailleCanvas_Destroy(&renderer->Canvas);
+        BrailleCanvas_Destroy(&renderer->Pending);
+        return -1;
+    }
+
+    renderer->HasPending = 0;
+    renderer->MaxFramesPerSecond = maxFramesPerSecond;
+    renderer->Quit = 0;
+    renderer->FramesSubmitted = 0;
+    renderer->FramesWritten = 0;
+    renderer->FramesDropped = 0;
+    memset(&renderer->LastFrame, 0, sizeof(renderer->LastFrame));
+
+    pthread_mutex_init(&renderer->Lock, NULL);
+    pthread_cond_init(&renderer->Wake, NULL);
+
+    if (pthread_create(&renderer->Thread, NULL, BrailleRenderThread_Main, renderer) != 0)
+    {
+        fprintf(stderr, "\nRender thread could not be created\n");
+        pthread_mutex_destroy(&renderer->Lock);
+        pthread_cond_destroy(&renderer->Wake);
+        BrailleCanvas_Destroy(&renderer->Canvas);
+        BrailleCanvas_Destroy(&renderer->Pending);
+        return -1;
+    }
+
+    renderer->Started = 1;
+    return 0;
+}
+
+// copies the canvas to the pending frame and wakes the thread - never waits for the terminal
+// the canvas must have the window size and storage given to BrailleRenderThread_Start
+void BrailleRenderThread_Submit(BrailleRenderThread* renderer, BrailleCanvas* canvas)
+{
+    BrailleCanvas_Flush(canvas); // queued drawing calls are part of the frame
+
+    pthread_mutex_lock(&renderer->Lock);
+
+    BrailleCanvas* pending = &renderer->Pending;
+    CopyWindow(pending, canvas);
+
+    pending->FillStyle = canvas->FillStyle;
+    pending->BackgroundStyle = canvas->BackgroundStyle;
+
+    // the changes inside the window, in cells of the window - when the window moved, all of it may have changed
+    BrailleRect window = {0, 0, pending->CharacterWidth, pending->CharacterHeight};
+    if (canvas->ViewColumn == renderer->ViewColumn && canvas->ViewRow == renderer->ViewRow)
+    {
+        BrailleRect view = {canvas->ViewColumn, canvas->ViewRow, canvas->ViewColumn + canvas->ViewWidth, canvas->ViewRow + canvas->ViewHeight};
+        BrailleRect dirty = canvas->Dirty;
+        BrailleRect_Intersect(&dirty, &view);
+
+        window = (BrailleRect){dirty.Left - view.Left, dirty.Top - view.Top, dirty.Right - view.Left, dirty.Bottom - view.Top};
+        if (dirty.Right <= dirty.Left)
+            window = (BrailleRect){0, 0, 0, 0};
+    }
+
+    renderer->ViewColumn = canvas->ViewColumn;
+    renderer->ViewRow = canvas->ViewRow;
+
+    // the changes of a dropped frame are still changes for the next one printed
+    BrailleRect_Union(&pending->Dirty, &window);
+    canvas->Dirty = (BrailleRect){0, 0, 0, 0}; // the render thread owns these changes now
+
+    renderer->FramesSubmitted++;
+    if (renderer->HasPending)
+        renderer->FramesDropped++; // the previous frame was never printed
+
+    renderer->HasPending = 1;
+    pthread_cond_signal(&renderer->Wake);
+
+    pthread_mutex_unlock(&renderer->Lock);
+}
+
+// stops the thread (a pending frame is not printed) and frees the frames - nothing to do when BrailleRenderThread_Start failed
+void BrailleRenderThread_Stop(BrailleRenderThread* renderer)
+{
+    if (!renderer->Started)
+        return;
+
+    pthread_mutex_lock(&renderer->Lock);
+    renderer->Quit = 1;
+    pthread_cond_signal(&renderer->Wake);
+    pthread_mutex_unlock(&renderer->Lock);
+
+    pthread_join(renderer->Thread, NULL);
+
+    pthread_mutex_destroy(&renderer->Lock);
+    pthread_cond_destroy(&renderer->Wake);
+    BrailleCanvas_Destroy(&renderer->Canvas);
+    BrailleCanvas_Destroy(&renderer->Pending);
+    renderer->Started = 0;
+}
@@ -0,0 +1,57 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+
+#ifndef _BRAILLE_RENDER_THREAD_H_
+#define _BRAILLE_RENDER_THREAD_H_
+
+#include <pthread.h>
+#include "braillecanvas.h"
+
+// renders canvases on a background thread
+// the application draws on its own canvas and submits it: the pixels are copied to the pending frame and the call returns,
+// while the thread prints the latest pending frame (incrementally) at most MaxFramesPerSecond times per second
+// a frame submitted before the previous one was printed replaces it
+// the terminal functions (and the renders, a frame at a time) take Terminal_Lock themselves, so the application can keep printing
+// next to the thread - holding Terminal_Lock around a sequence that must stay together, like a cursor move and its text
+typedef struct
+{
+    BrailleCanvas Canvas; // the frame being printed - only touched by the thread
+    BrailleCanvas Pending; // the latest submitted frame
+    uint8_t HasPending;
+    uint16_t ViewColumn; // window of the last submitted canvas
+    uint16_t ViewRow;
+
+    uint16_t MaxFramesPerSecond;
+
+    pthread_t Thread;
+    pthread_mutex_t Lock;
+    pthread_cond_t Wake;
+    uint8_t Quit;
+    uint8_t Started; // BrailleRenderThread_Start succeeded: the thread runs until BrailleRenderThread_Stop
+
+    // counters
+    uint32_t FramesSubmitted;
+    uint32_t FramesWritten;
+    uint32_t FramesDropped;
+    BrailleRenderStats LastFrame;
+} BrailleRenderThread;
+
+int BrailleRenderThread_Start(BrailleRenderThread*, BrailleCanvas* layout, uint16_t maxFramesPerSecond);
+void BrailleRenderThread_Submit(BrailleRenderThread*, BrailleCanvas*);
+void BrailleRenderThread_Stop(BrailleRenderThread*);
+
+#endif // _BRAILLE_RENDER_THREAD_H_
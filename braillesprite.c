@@ -0,0 +1,157 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+#include "braillesprite.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VARIANTS (BRAILLE_PIXELS_WIDTH * BRAILLE_PIXELS_HEIGHT)
+
+// rounds down, also for negative values
+#define floorDiv(a,b) ((a) >= 0 ? (a) / (b) : -((-(int64_t)(a) + (b) - 1) / (b)))
+
+int BrailleSprite_Create(BrailleSprite* sprite, const uint8_t* pixels, int32_t width, int32_t height)
+{
+    memset(sprite, 0, sizeof(BrailleSprite));
+
+    if (width <= 0 || height <= 0 || width > UINT16_MAX || height > UINT16_MAX)
+    {
+        fprintf(stderr, "BrailleSprite_Create: invalid size %dx%d\n", width, height);
+        return -1;
+    }
+
+    sprite->Width = width;
+    sprite->Height = height;
+    sprite->CellsWidth = (width + BRAILLE_PIXELS_WIDTH - 1) / BRAILLE_PIXELS_WIDTH + 1;
+    sprite->CellsHeight = (height + BRAILLE_PIXELS_HEIGHT - 1) / BRAILLE_PIXELS_HEIGHT + 1;
+
+    size_t cells = (size_t)sprite->CellsWidth * sprite->CellsHeight;
+    sprite->Masks = (uint8_t*)malloc(cells * VARIANTS);
+    sprite->Pixels = (uint8_t*)malloc((size_t)width * height);
+
+    if (!sprite->Masks || !sprite->Pixels)
+    {
+        fprintf(stderr, "BrailleSprite_Create: unable to allocate a %dx%d sprite\n", width, height);
+        BrailleSprite_Destroy(sprite);
+        return -1;
+    }
+
+    for (size_t i = 0; i < (size_t)width * height; i++)
+        sprite->Pixels[i] = pixels[i] != 0;
+
+    // each variant is drawn once on a packed canvas, whose buffer then holds its braille patterns
+    BrailleCanvas scratch;
+    BrailleCanvas_CreateOffscreen(&scratch, sprite->CellsWidth, sprite->CellsHeight, BRAILLE_STORAGE_PACKED);
+
+    for (int32_t dy = 0; dy < BRAILLE_PIXELS_HEIGHT; dy++)
+        for (int32_t dx = 0; dx < BRAILLE_PIXELS_WIDTH; dx++)
+        {
+            memset(scratch.PixelBuffer, 0, cells);
+
+            for (int32_t y = 0; y < height; y++)
+                for (int32_t x = 0; x < width; x++)
+                    if (sprite->Pixels[x + (size_t)y*width])
+                        BrailleCanvas_SetPixel(&scratch, dx + x, dy + y);
+
+            memcpy(sprite->Masks + (dx + dy*BRAILLE_PIXELS_WIDTH) * cells, scratch.PixelBuffer, cells);
+        }
+
+    BrailleCanvas_Destroy(&scratch);
+    return 0;
+}
+
+void BrailleSprite_Destroy(BrailleSprite* sprite)
+{
+    free(sprite->Masks);
+    free(sprite->Pixels);
+    sprite->Masks = NULL;
+    sprite->Pixels = NULL;
+}
+
+void BrailleSprite_Blit(const BrailleSprite* sprite, BrailleCanvas* canvas, int32_t x, int32_t y, BrailleBlitMode mode)
+{
+    BrailleCanvas_Flush(canvas); // queued drawing happened before
+
+    // the cell holding the top-left pixel, and the variant for the position of that pixel inside it
+    int64_t column = floorDiv(x, BRAILLE_PIXELS_WIDTH);
+    int64_t row = floorDiv(y, BRAILLE_PIXELS_HEIGHT);
+    int32_t dx = (int32_t)(x - column*BRAILLE_PIXELS_WIDTH);
+    int32_t dy = (int32_t)(y - row*BRAILLE_PIXELS_HEIGHT);
+
+    // cells of the sprite inside the clip rectangle
+    int64_t left = column > canvas->Clip.Left ? column : canvas->Clip.Left;
+    int64_t top = row > canvas->Clip.Top ? row : canvas->Clip.Top;
+    int64_t right = column + sprite->CellsWidth < canvas->Clip.Right ? column + sprite->CellsWidth : canvas->Clip.Right;
+    int64_t bottom = row + sprite->CellsHeight < canvas->Clip.Bottom ? row + sprite->CellsHeight : canvas->Clip.Bottom;
+
+    if (right <= left || bottom <= top)
+        return;
+
+    const uint8_t* masks = sprite->Masks + (size_t)(dx + dy*BRAILLE_PIXELS_WIDTH) * sprite->CellsWidth * sprite->CellsHeight;
+    size_t count = (size_t)(right - left);
+
+    for (int64_t r = top; r < bottom; r++)
+    {
+        const uint8_t* mask = masks + (size_t)(left - column) + (size_t)(r - row) * sprite->CellsWidth;
+
+        if (canvas->Storage == BRAILLE_STORAGE_PACKED)
+        {
+            uint8_t* cells = canvas->PixelBuffer + (size_t)left + (size_t)r * canvas->CharacterWidth;
+            switch (mode)
+            {
+                case BRAILLE_BLIT_OR: for (size_t i = 0; i < count; i++) cells[i] |= mask[i]; break;
+                case BRAILLE_BLIT_CLEAR: for (size_t i = 0; i < count; i++) cells[i] &= ~mask[i]; break;
+                case BRAILLE_BLIT_XOR: for (size_t i = 0; i < count; i++) cells[i] ^= mask[i]; break;
+            }
+        }
+
+        if (canvas->StylePlane && mode != BRAILLE_BLIT_CLEAR)
+        {
+            BrailleCellStyle* styles = canvas->StylePlane + (size_t)left + (size_t)r * canvas->CharacterWidth;
+            for (size_t i = 0; i < count; i++)
+                if (mask[i])
+                    styles[i] = canvas->Pen;
+        }
+    }
+
+    // pixels inside those cells
+    int64_t x0 = left*BRAILLE_PIXELS_WIDTH > x ? left*BRAILLE_PIXELS_WIDTH : x;
+    int64_t y0 = top*BRAILLE_PIXELS_HEIGHT > y ? top*BRAILLE_PIXELS_HEIGHT : y;
+    int64_t x1 = right*BRAILLE_PIXELS_WIDTH < (int64_t)x + sprite->Width ? right*BRAILLE_PIXELS_WIDTH : (int64_t)x + sprite->Width;
+    int64_t y1 = bottom*BRAILLE_PIXELS_HEIGHT < (int64_t)y + sprite->Height ? bottom*BRAILLE_PIXELS_HEIGHT : (int64_t)y + sprite->Height;
+
+    if (x1 <= x0 || y1 <= y0)
+        return;
+
+    if (canvas->Storage == BRAILLE_STORAGE_PIXELS) // one byte per pixel: the rows of the sprite are combined directly
+    {
+        count = (size_t)(x1 - x0);
+        for (int64_t py = y0; py < y1; py++)
+        {
+            const uint8_t* source = sprite->Pixels + (size_t)(x0 - x) + (size_t)(py - y) * sprite->Width;
+            uint8_t* pixels = canvas->PixelBuffer + (size_t)x0 + (size_t)py * canvas->PixelsWidth;
+            switch (mode)
+            {
+                case BRAILLE_BLIT_OR: for (size_t i = 0; i < count; i++) pixels[i] |= source[i]; break;
+                case BRAILLE_BLIT_CLEAR: for (size_t i = 0; i < count; i++) pixels[i] &= source[i] ^ 1; break;
+                case BRAILLE_BLIT_XOR: for (size_t i = 0; i < count; i++) pixels[i] ^= source[i]; break;
+            }
+        }
+    }
+
+    BrailleCanvas_MarkDirty(canvas, (int32_t)x0, (int32_t)y0, (int32_t)(x1 - x0), (int32_t)(y1 - y0));
+}
@@ -0,0 +1,53 @@
+// ===================================================================================  //
+//    This program is free software: you can redistribute it and/or modify              //
+//    it under the terms of the GNU General Public License as published by              //
+//    the Free Software Foundation, either version 3 of the License, or                 //
+//    (at your option) any later version.                                               //
+//                                                                                      //
+//    This program is distributed in the hope that it will be useful,                   //
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of                    //
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                     //
+//    GNU General Public License for more details.                                      //
+//                                                                                      //
+//    You should have received a copy of the GNU General Public License                 //
+//    along with this program.  If not, see <https://www.gnu.org/licenses/>5.           //
+//                                                                                      //
+//    Copyright: Luiz Gustavo Pfitscher e Feldmann, 2020                                //
+// ===================================================================================  //
+#ifndef _BRAILLE_SPRITE_H_
+#define _BRAILLE_SPRITE_H_
+
+#include "braillecanvas.h"
+
+typedef enum {
+    BRAILLE_BLIT_OR = 0, // sets the pixels of the sprite
+    BRAILLE_BLIT_CLEAR = 1, // clears them
+    BRAILLE_BLIT_XOR = 2, // flips them
+} BrailleBlitMode;
+
+// a bitmap prepared for fast drawing: the braille patterns it covers are computed once for each of the
+// BRAILLE_PIXELS_WIDTH x BRAILLE_PIXELS_HEIGHT positions it can have inside a cell, so drawing it at any pixel
+// is one byte operation per cell (packed storage) or per pixel row run (pixel storage)
+typedef struct
+{
+    int32_t Width; // in pixels
+    int32_t Height;
+
+    // cells covered by every variant, whatever its position inside the first cell
+    uint16_t CellsWidth;
+    uint16_t CellsHeight;
+
+    uint8_t* Masks; // braille patterns of the variant starting dx, dy pixels into a cell at Masks + (dx + dy*BRAILLE_PIXELS_WIDTH)*CellsWidth*CellsHeight
+    uint8_t* Pixels; // one byte per pixel, 0 or 1
+} BrailleSprite;
+
+// "pixels" holds width*height bytes, row by row: the pixel is set where the byte is not zero
+// returns 0 on success
+int BrailleSprite_Create(BrailleSprite*, const uint8_t* pixels, int32_t width, int32_t height);
+void BrailleSprite_Destroy(BrailleSprite*);
+
+// draws the sprite with its top-left pixel at x, y, clipped to the clip rectangle
+// the canvas pen colors the cells the sprite sets or flips; drawing calls queued before are flushed, and blits are not recorded in display lists
+void BrailleSprite_Blit(const BrailleSprite*, BrailleCanvas*, int32_t x, int32_t y, BrailleBlitMode);
+
+#endif // _BRAILLE_SPRITE_H_
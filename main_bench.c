@@ -0,0 +1,555 @@
+#include "braillecanvas.h"
+#include "braillechart.h"
+#include "brailleimage.h"
+#include "braillerecorder.h"
+#include "braillesprite.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <math.h>
+
+#ifdef WIN32
+    #include <windows.h>
+    #include <io.h>
+    #define NULL_DEVICE "NUL"
+    double NOWSEC() { LARGE_INTEGER f, t; QueryPerformanceFrequency(&f); QueryPerformanceCounter(&t); return (double)t.QuadPart / f.QuadPart; }
+#else
+    #include <time.h>
+    #include <unistd.h>
+    #define NULL_DEVICE "/dev/null"
+    double NOWSEC() { struct timespec t; clock_gettime(CLOCK_MONOTONIC, &t); return t.tv_sec + t.tv_nsec*1e-9; }
+#endif
+
+// every stage runs on these canvas sizes (in cells) and storage modes
+const uint8_t sizes[][2] = {
+    {80, 24},
+    {250, 80},
+};
+
+const BrailleCanvasStorage storages[] = {
+    BRAILLE_STORAGE_PIXELS,
+    BRAILLE_STORAGE_PACKED,
+};
+
+const char* storage_names[] = {
+    "pixels",
+    "packed",
+};
+
+#define BENCH_SECONDS 0.2 // minimum measuring time of each benchmark
+#define BENCH_SHAPES 64 // shapes drawn per raster frame
+
+// keeps the compiler from optimizing the benchmarked work away
+volatile uint32_t sink;
+
+// what a benchmark frame did - all per frame
+typedef struct
+{
+    double pixels;
+    double cells;
+    double bytes;
+    double calls;
+} BenchWork;
+
+// RASTER STAGE: each frame draws the same BENCH_SHAPES shapes, placed at random inside the canvas
+//===========================================================================================
+typedef void (*ShapeFunc)(BrailleCanvas*, int);
+
+uint16_t shape_args[BENCH_SHAPES][4];
+
+void shape_stroke_line(BrailleCanvas* canvas, int i) { BrailleCanvas_StrokeLine(canvas, shape_args[i][0], shape_args[i][1], shape_args[i][2], shape_args[i][3]); }
+void shape_stroke_rectangle(BrailleCanvas* canvas, int i) { BrailleCanvas_StrokeRectangle(canvas, shape_args[i][0]/2, shape_args[i][1]/2, shape_args[i][2]/2, shape_args[i][3]/2); }
+void shape_fill_rectangle(BrailleCanvas* canvas, int i) { BrailleCanvas_FillRectangle(canvas, shape_args[i][0]/2, shape_args[i][1]/2, shape_args[i][2]/2, shape_args[i][3]/2); }
+void shape_stroke_circle(BrailleCanvas* canvas, int i) { BrailleCanvas_StrokeCircle(canvas, shape_args[i][0], shape_args[i][1], shape_args[i][3]/4); }
+void shape_fill_circle(BrailleCanvas* canvas, int i) { BrailleCanvas_FillCircle(canvas, shape_args[i][0], shape_args[i][1], shape_args[i][3]/4); }
+void shape_stroke_line_offscreen(BrailleCanvas* canvas, int i) { BrailleCanvas_StrokeLine(canvas, shape_args[i][0] - 100000, shape_args[i][1], shape_args[i][2] + 100000, shape_args[i][3]); }
+void shape_stroke_polyline(BrailleCanvas* canvas, int i)
+{
+    const uint16_t* a = shape_args[i];
+    const uint16_t* b = shape_args[(i + 1) % BENCH_SHAPES];
+    BraillePoint points[] = { {a[0], a[1]}, {a[2], a[3]}, {b[0], b[1]}, {b[2], b[3]} };
+    BrailleCanvas_StrokePolyline(canvas, points, 4);
+}
+
+// a self-intersecting pentagram through the points of two shapes
+void shape_fill_polygon(BrailleCanvas* canvas, int i)
+{
+    const uint16_t* a = shape_args[i];
+    const uint16_t* b = shape_args[(i + 1) % BENCH_SHAPES];
+    BraillePoint points[] = { {a[0], a[1]}, {b[0], b[1]}, {a[2], a[3]}, {b[2], b[3]}, {(a[0] + b[2]) / 2, (a[3] + b[1]) / 2} };
+    BrailleCanvas_FillPolygon(canvas, points, 5, BRAILLE_FILL_NONZERO);
+}
+
+void shape_stroke_ellipse(BrailleCanvas* canvas, int i) { BrailleCanvas_StrokeEllipse(canvas, shape_args[i][0], shape_args[i][1], shape_args[i][2]/4, shape_args[i][3]/4); }
+void shape_fill_ellipse(BrailleCanvas* canvas, int i) { BrailleCanvas_FillEllipse(canvas, shape_args[i][0], shape_args[i][1], shape_args[i][2]/4, shape_args[i][3]/4); }
+void shape_fill_arc(BrailleCanvas* canvas, int i) { BrailleCanvas_FillArc(canvas, shape_args[i][0], shape_args[i][1], shape_args[i][2]/4, shape_args[i][3]/4, BRAILLE_DEGREES(i * 37), BRAILLE_DEGREES(100 + i)); }
+
+// a 12x12 marker: a ring with a dot
+#define SPRITE_SIZE 12
+uint8_t sprite_pixels[SPRITE_SIZE * SPRITE_SIZE];
+BrailleSprite bench_sprite;
+
+void make_sprite()
+{
+    for (int y = 0; y < SPRITE_SIZE; y++)
+        for (int x = 0; x < SPRITE_SIZE; x++)
+        {
+            int r = (2*x - SPRITE_SIZE + 1) * (2*x - SPRITE_SIZE + 1) + (2*y - SPRITE_SIZE + 1) * (2*y - SPRITE_SIZE + 1);
+            sprite_pixels[x + y*SPRITE_SIZE] = (r >= 64 && r <= 121) || r <= 9;
+        }
+
+    BrailleSprite_Create(&bench_sprite, sprite_pixels, SPRITE_SIZE, SPRITE_SIZE);
+}
+
+void shape_blit_sprite(BrailleCanvas* canvas, int i) { BrailleSprite_Blit(&bench_sprite, canvas, shape_args[i][0], shape_args[i][1], BRAILLE_BLIT_OR); }
+
+// the same marker drawn pixel by pixel
+void shape_set_pixel_sprite(BrailleCanvas* canvas, int i)
+{
+    for (int y = 0; y < SPRITE_SIZE; y++)
+        for (int x = 0; x < SPRITE_SIZE; x++)
+            if (sprite_pixels[x + y*SPRITE_SIZE])
+                BrailleCanvas_SetPixel(canvas, shape_args[i][0] + x, shape_args[i][1] + y);
+}
+
+const struct { const char* name; ShapeFunc func; } shapes[] = {
+    {"stroke_line", shape_stroke_line},
+    {"stroke_rectangle", shape_stroke_rectangle},
+    {"fill_rectangle", shape_fill_rectangle},
+    {"stroke_circle", shape_stroke_circle},
+    {"fill_circle", shape_fill_circle},
+    {"stroke_line_offscreen", shape_stroke_line_offscreen},
+    {"stroke_polyline", shape_stroke_polyline},
+    {"fill_polygon", shape_fill_polygon},
+    {"stroke_ellipse", shape_stroke_ellipse},
+    {"fill_ellipse", shape_fill_ellipse},
+    {"fill_arc", shape_fill_arc},
+    {"blit_sprite", shape_blit_sprite},
+    {"set_pixel_sprite", shape_set_pixel_sprite},
+};
+
+ShapeFunc bench_shape;
+
+// number of lit pixels
+uint32_t count_pixels(BrailleCanvas* canvas)
+{
+    uint32_t lit = 0;
+    for (uint16_t y = 0; y < canvas->PixelsHeight; y++)
+        for (uint16_t x = 0; x < canvas->PixelsWidth; x++)
+            lit += BrailleCanvas_GetPixel(canvas, x, y);
+
+    return lit;
+}
+
+void bench_raster(BrailleCanvas* canvas, BenchWork* work)
+{
+    for (int i = 0; i < BENCH_SHAPES; i++)
+        bench_shape(canvas, i);
+}
+
+// pixels written by one frame: each shape is measured alone, so overlapping shapes still count
+double raster_pixels(BrailleCanvas* canvas)
+{
+    double pixels = 0;
+    for (int i = 0; i < BENCH_SHAPES; i++)
+    {
+        BrailleCanvas_WipeClean(canvas);
+        bench_shape(canvas, i);
+        pixels += count_pixels(canvas);
+    }
+
+    return pixels;
+}
+//===========================================================================================
+
+// CHART STAGE: a strip chart as wide as the canvas receives one sample per frame
+//===========================================================================================
+BrailleChart bench_chart;
+
+// shifts the chart and draws the new sample
+void bench_chart_tick(BrailleCanvas* canvas, BenchWork* work)
+{
+    BrailleChart_Push(&bench_chart, sinf(bench_chart.Count * 0.05f));
+    BrailleChart_Draw(&bench_chart);
+}
+
+// wipes the chart and draws its whole history
+void bench_chart_redraw(BrailleCanvas* canvas, BenchWork* work)
+{
+    BrailleChart_Push(&bench_chart, sinf(bench_chart.Count * 0.05f));
+    BrailleChart_Redraw(&bench_chart);
+}
+//===========================================================================================
+
+// IMPORT STAGE: a 640x480 camera-sized frame dithered onto the whole canvas
+//===========================================================================================
+#define IMPORT_WIDTH 640
+#define IMPORT_HEIGHT 480
+
+uint8_t import_pixels[IMPORT_WIDTH * IMPORT_HEIGHT * 3];
+BrailleImage import_image;
+BrailleDither import_dither;
+
+void make_import_image()
+{
+    for (int y = 0; y < IMPORT_HEIGHT; y++)
+        for (int x = 0; x < IMPORT_WIDTH; x++)
+        {
+            uint8_t* rgb = &import_pixels[(x + y*IMPORT_WIDTH) * 3];
+            rgb[0] = (uint8_t)(127.5f + 127.5f * sinf(x / 37.0f) * cosf(y / 23.0f));
+            rgb[1] = (uint8_t)(x * 255 / IMPORT_WIDTH);
+            rgb[2] = (uint8_t)(y * 255 / IMPORT_HEIGHT);
+        }
+
+    BrailleImage_Wrap(&import_image, import_pixels, IMPORT_WIDTH, IMPORT_HEIGHT, IMPORT_WIDTH * 3, 3);
+}
+
+void bench_import(BrailleCanvas* canvas, BenchWork* work)
+{
+    BrailleImage_Draw(&import_image, canvas, 0, 0, canvas->PixelsWidth, canvas->PixelsHeight, import_dither, 128, 4);
+}
+//===========================================================================================
+
+// ENCODE STAGE
+//===========================================================================================
+// packs every cell of the canvas one glyph at a time
+void bench_pack_getcharacter(BrailleCanvas* canvas, BenchWork* work)
+{
+    uint32_t checksum = 0;
+    for (uint16_t row = 0; row < canvas->CharacterHeight; row++)
+        for (uint16_t col = 0; col < canvas->CharacterWidth; col++)
+        {
+            uint32_t unicode;
+            BrailleCanvas_GetCharacter(canvas, row, col, &unicode);
+            checksum += unicode;
+        }
+
+    sink = checksum;
+}
+
+// packs every cell of the canvas a whole row at a time
+void bench_pack_row(BrailleCanvas* canvas, BenchWork* work)
+{
+    uint8_t patterns[canvas->CharacterWidth];
+    uint32_t checksum = 0;
+    for (uint16_t row = 0; row < canvas->CharacterHeight; row++)
+    {
+        BrailleCanvas_PackRow(canvas, row, 0, canvas->CharacterWidth, patterns);
+        checksum += patterns[row % canvas->CharacterWidth];
+    }
+
+    sink = checksum;
+}
+
+// turns every row of patterns into utf-8 text
+void bench_encode_rows(BrailleCanvas* canvas, BenchWork* work)
+{
+    uint8_t patterns[canvas->CharacterWidth];
+    char text[canvas->CharacterWidth * 3];
+    uint32_t bytes = 0;
+    for (uint16_t row = 0; row < canvas->CharacterHeight; row++)
+    {
+        memcpy(patterns, &canvas->FrontBuffer[row * canvas->CharacterWidth], canvas->CharacterWidth); // packed by the setup render
+        bytes += BrailleCanvas_EncodeRow(patterns, canvas->CharacterWidth, text) - text;
+    }
+
+    sink = bytes;
+    work->bytes = bytes;
+}
+//===========================================================================================
+
+// CALLBACK STAGE: the scene is copied into a text frame buffer, as a ui toolkit hosting the canvas would
+//===========================================================================================
+char callback_frame[250 * 80 * 4];
+uint32_t callback_calls;
+
+void callback_cell(uint8_t x, uint8_t y, uint8_t width, uint8_t height, char* utf8, void* object)
+{
+    memcpy(&callback_frame[(x + y*width) * 4], utf8, 4);
+    callback_calls++;
+}
+
+void callback_span(const BrailleSpan* span, void* object)
+{
+    memcpy(&callback_frame[(span->Column + span->Row * 250) * 4], span->Text, span->TextLength);
+    callback_calls++;
+}
+
+// one indirect call per non-blank cell
+void bench_callback_cells(BrailleCanvas* canvas, BenchWork* work)
+{
+    callback_calls = 0;
+    BrailleCanvas_Render_ByCallback(canvas, NULL, callback_cell);
+    work->calls = callback_calls;
+}
+
+// one indirect call per run of non-blank cells
+void bench_callback_spans(BrailleCanvas* canvas, BenchWork* work)
+{
+    callback_calls = 0;
+    BrailleCanvas_Render_SpansByCallback(canvas, NULL, BRAILLE_SPAN_UTF8, callback_span);
+    work->calls = callback_calls;
+}
+
+// the animation frame of the output stage, handed over as the runs of changed cells
+void bench_callback_changed(BrailleCanvas* canvas, BenchWork* work)
+{
+    static uint32_t frame = 0;
+    uint16_t x = (frame++ * 3) % canvas->PixelsWidth;
+
+    BrailleCanvas_FillCircle(canvas, x, canvas->PixelsHeight / 2, 6);
+
+    callback_calls = 0;
+    BrailleCanvas_Render_SpansByCallback(canvas, NULL, BRAILLE_SPAN_UTF8 | BRAILLE_SPAN_CHANGED, callback_span);
+    work->calls = callback_calls;
+
+    for (int y = -6; y <= 6; y++)
+        for (int dx = -6; dx <= 6; dx++)
+            if (x + dx >= 0 && canvas->PixelsHeight/2 + y >= 0)
+                BrailleCanvas_ClearPixel(canvas, x + dx, canvas->PixelsHeight/2 + y);
+}
+//===========================================================================================
+
+// OUTPUT STAGE (the terminal sink is the null device)
+//===========================================================================================
+// a complete repaint, as the first frame or after a style change
+void bench_output_full(BrailleCanvas* canvas, BenchWork* work)
+{
+    BrailleRenderStats stats;
+    BrailleCanvas_Invalidate(canvas);
+    BrailleCanvas_RenderDiff(canvas, &stats);
+    work->bytes = stats.BytesEmitted;
+}
+
+// an animation frame: a small moving shape over a static scene, printed incrementally
+void bench_output_diff(BrailleCanvas* canvas, BenchWork* work)
+{
+    static uint32_t frame = 0;
+    uint16_t x = (frame++ * 3) % canvas->PixelsWidth;
+
+    BrailleCanvas_FillCircle(canvas, x, canvas->PixelsHeight / 2, 6);
+
+    BrailleRenderStats stats;
+    BrailleCanvas_RenderDiff(canvas, &stats);
+    work->bytes = stats.BytesEmitted;
+    work->cells = stats.CellsEmitted;
+
+    // take the circle away again: the next frame prints both the old and the new position
+    for (int y = -6; y <= 6; y++)
+        for (int dx = -6; dx <= 6; dx++)
+            if (x + dx >= 0 && canvas->PixelsHeight/2 + y >= 0)
+                BrailleCanvas_ClearPixel(canvas, x + dx, canvas->PixelsHeight/2 + y);
+}
+//===========================================================================================
+
+// RECORD STAGE (the recording goes to the null device)
+//===========================================================================================
+BrailleRecorder bench_recorder;
+uint32_t bench_recorded; // frames given to the recorder
+
+// the animation frame of the output stage, recorded as the cells it changed (and a keyframe every 60 frames)
+void bench_record_capture(BrailleCanvas* canvas, BenchWork* work)
+{
+    static uint32_t frame = 0;
+    uint16_t x = (frame * 3) % canvas->PixelsWidth;
+
+    BrailleCanvas_FillCircle(canvas, x, canvas->PixelsHeight / 2, 6);
+
+    BrailleRecorder_CaptureAt(&bench_recorder, canvas, frame++ * 16667);
+    work->bytes = (double)bench_recorder.Bytes / ++bench_recorded; // keyframes included
+
+    for (int y = -6; y <= 6; y++)
+        for (int dx = -6; dx <= 6; dx++)
+            if (x + dx >= 0 && canvas->PixelsHeight/2 + y >= 0)
+                BrailleCanvas_ClearPixel(canvas, x + dx, canvas->PixelsHeight/2 + y);
+}
+//===========================================================================================
+
+// runs a frame function for at least BENCH_SECONDS and returns the seconds per frame
+double bench_time(BrailleCanvas* canvas, void(*frame)(BrailleCanvas*, BenchWork*), BenchWork* work)
+{
+    frame(canvas, work); // warm up
+
+    uint32_t frames = 0;
+    double start = NOWSEC();
+    double elapsed;
+    do
+    {
+        for (int i = 0; i < 16; i++)
+            frame(canvas, work);
+
+        frames += 16;
+        elapsed = NOWSEC() - start;
+    } while (elapsed < BENCH_SECONDS);
+
+    return elapsed / frames;
+}
+
+// one json object per line
+void report(FILE* results, const char* stage, const char* name, BrailleCanvas* canvas, const char* storage, double seconds, BenchWork* work)
+{
+    fprintf(results, "{\"stage\":\"%s\",\"bench\":\"%s\",\"width\":%u,\"height\":%u,\"storage\":\"%s\",\"ns_per_frame\":%.0f",
+           stage, name, canvas->CharacterWidth, canvas->CharacterHeight, storage, seconds * 1e9);
+
+    if (work->pixels > 0)
+        fprintf(results, ",\"pixels_per_s\":%.0f", work->pixels / seconds);
+
+    if (work->cells > 0)
+        fprintf(results, ",\"cells_per_s\":%.0f", work->cells / seconds);
+
+    if (work->bytes > 0)
+        fprintf(results, ",\"bytes_per_frame\":%.0f", work->bytes);
+
+    if (work->calls > 0)
+        fprintf(results, ",\"calls_per_frame\":%.0f", work->calls);
+
+    fprintf(results, "}\n");
+    fflush(results);
+}
+
+// the same random scene for every size
+void scene(BrailleCanvas* canvas)
+{
+    BrailleCanvas_WipeClean(canvas);
+    for (int i = 0; i < BENCH_SHAPES; i++)
+    {
+        shape_stroke_line(canvas, i);
+        shape_stroke_circle(canvas, i);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    FILE* results = stdout;
+
+    // the output stage writes to the null device, as a terminal that never makes the frames wait
+    TerminalSink null;
+    int device = open(NULL_DEVICE, O_WRONLY);
+    TerminalSink_CreateDescriptor(&null, device);
+    Terminal_SetSink(&null);
+
+    make_sprite();
+    make_import_image();
+
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++)
+        for (size_t m = 0; m < sizeof(storages)/sizeof(storages[0]); m++)
+        {
+            BrailleCanvas canvas;
+            BrailleCanvas_CreateEx(&canvas, 1, 1, sizes[s][0], sizes[s][1], storages[m]);
+
+            srand(1);
+            for (int i = 0; i < BENCH_SHAPES; i++)
+            {
+                shape_args[i][0] = rand() % canvas.PixelsWidth;
+                shape_args[i][1] = rand() % canvas.PixelsHeight;
+                shape_args[i][2] = rand() % canvas.PixelsWidth;
+                shape_args[i][3] = rand() % canvas.PixelsHeight;
+            }
+
+            BenchWork work;
+            double seconds;
+            double cells = (double)canvas.CharacterWidth * canvas.CharacterHeight;
+            const char* storage = storage_names[m];
+
+            #define RESULT(stage, name) report(results, stage, name, &canvas, storage, seconds, &work)
+
+            for (size_t k = 0; k < sizeof(shapes)/sizeof(shapes[0]); k++)
+            {
+                bench_shape = shapes[k].func;
+                memset(&work, 0, sizeof(work));
+                work.pixels = raster_pixels(&canvas);
+                seconds = bench_time(&canvas, bench_raster, &work);
+                RESULT("raster", shapes[k].name);
+            }
+
+            const struct { const char* name; BrailleDither dither; } dithers[] = {
+                {"threshold", BRAILLE_DITHER_THRESHOLD},
+                {"ordered", BRAILLE_DITHER_ORDERED},
+                {"floyd_steinberg", BRAILLE_DITHER_FLOYD_STEINBERG},
+            };
+
+            for (size_t d = 0; d < sizeof(dithers)/sizeof(dithers[0]); d++)
+            {
+                import_dither = dithers[d].dither;
+                memset(&work, 0, sizeof(work));
+                work.pixels = (double)canvas.PixelsWidth * canvas.PixelsHeight;
+                seconds = bench_time(&canvas, bench_import, &work);
+                RESULT("import", dithers[d].name);
+            }
+
+            BrailleChart_Create(&bench_chart, &canvas, canvas.PixelsWidth + 1, -1, 1);
+            for (int32_t i = 0; i < canvas.PixelsWidth; i++)
+                BrailleChart_Push(&bench_chart, sinf(i * 0.05f));
+
+            memset(&work, 0, sizeof(work));
+            seconds = bench_time(&canvas, bench_chart_tick, &work);
+            RESULT("chart", "tick");
+
+            memset(&work, 0, sizeof(work));
+            seconds = bench_time(&canvas, bench_chart_redraw, &work);
+            RESULT("chart", "redraw");
+
+            BrailleChart_Destroy(&bench_chart);
+
+            scene(&canvas);
+            BrailleCanvas_Render(&canvas); // fills the front buffer for the encode stage
+
+            memset(&work, 0, sizeof(work));
+            work.cells = cells;
+            seconds = bench_time(&canvas, bench_pack_getcharacter, &work);
+            RESULT("encode", "pack_getcharacter");
+
+            memset(&work, 0, sizeof(work));
+            work.cells = cells;
+            seconds = bench_time(&canvas, bench_pack_row, &work);
+            char kernel[32];
+            snprintf(kernel, sizeof(kernel), "pack_row_%s", canvas.Storage == BRAILLE_STORAGE_PACKED ? "copy" : BrailleCanvas_GetPackKernel());
+            RESULT("encode", kernel);
+
+            memset(&work, 0, sizeof(work));
+            work.cells = cells;
+            seconds = bench_time(&canvas, bench_encode_rows, &work);
+            RESULT("encode", "utf8_rows");
+
+            memset(&work, 0, sizeof(work));
+            work.cells = cells;
+            seconds = bench_time(&canvas, bench_callback_cells, &work);
+            RESULT("callback", "cells");
+
+            memset(&work, 0, sizeof(work));
+            work.cells = cells;
+            seconds = bench_time(&canvas, bench_callback_spans, &work);
+            RESULT("callback", "spans");
+
+            memset(&work, 0, sizeof(work));
+            seconds = bench_time(&canvas, bench_callback_changed, &work);
+            RESULT("callback", "spans_changed");
+
+            memset(&work, 0, sizeof(work));
+            work.cells = cells;
+            seconds = bench_time(&canvas, bench_output_full, &work);
+            RESULT("output", "full_frame");
+
+            memset(&work, 0, sizeof(work));
+            seconds = bench_time(&canvas, bench_output_diff, &work);
+            RESULT("output", "diff_frame");
+
+            BrailleRecorder_Create(&bench_recorder, NULL_DEVICE, 60);
+            bench_recorded = 0;
+            memset(&work, 0, sizeof(work));
+            seconds = bench_time(&canvas, bench_record_capture, &work);
+            RESULT("record", "capture");
+            BrailleRecorder_Close(&bench_recorder);
+
+            #undef RESULT
+
+            BrailleCanvas_Destroy(&canvas);
+        }
+
+    BrailleSprite_Destroy(&bench_sprite);
+    Terminal_SetSink(NULL);
+    TerminalSink_Destroy(&null);
+    close(device);
+    return 0;
+}
@@ -67,8 +67,10 @@ const int styles[][2] = {
 int main(int argc, char** argv)
 {
     // get terminal dimensions
-    uint8_t w, h;
+    uint16_t w, h;
     Terminal_GetSize(&w, &h);
+    w = max(w, 3); // the border leaves at least one cell, however small the terminal
+    h = max(h, 3);
 
     // create a canvas inside terminal - leave a border
     BrailleCanvas canvas;
@@ -82,6 +84,15 @@ int main(int argc, char** argv)
 
     for (int i = 0; i < numframes; i++)
     {
+        // follow the terminal size
+        if (Terminal_Resized())
+        {
+            Terminal_GetSize(&w, &h);
+            w = max(w, 3);
+            h = max(h, 3);
+            BrailleCanvas_Resize(&canvas, w - 2, h - 2);
+        }
+
         int style_index = i/4 % numstyles;
         canvas.BackgroundStyle = styles[style_index][0];
         canvas.FillStyle = styles[style_index][1];
@@ -18,8 +18,57 @@
 #include "terminal.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <pthread.h>
 
+#if (defined(WIN32) || defined(_WIN32) || defined(__WIN32) || defined(__WIN32__))
+    #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <signal.h>
+#endif
+
+// totals behind the canvas performance counters - compiled out unless BRAILLE_CANVAS_STATS is defined
+#ifdef BRAILLE_CANVAS_STATS
+    static uint64_t terminal_bytes = 0;
+    static uint64_t terminal_escapes = 0;
+    #define countBytes(n) (terminal_bytes += (n))
+    #define countEscapes(n) (terminal_escapes += (n))
+#else
+    #define countBytes(n)
+    #define countEscapes(n)
+#endif
+
+void Terminal_GetCounters(uint64_t* bytes, uint64_t* escapes)
+{
+    #ifdef BRAILLE_CANVAS_STATS
+    *bytes = terminal_bytes;
+    *escapes = terminal_escapes;
+    #else
+    *bytes = 0;
+    *escapes = 0;
+    #endif
+}
+
+// writes the decimal digits of the value and returns the end of the text (not null-terminated)
+static char* Terminal_FormatUInt(char* out, uint32_t value)
+{
+    char digits[10];
+    int count = 0;
+
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    while (count)
+        *out++ = digits[--count];
+
+    return out;
+}
+
 // UNIX SPECIFIC CODE
 //===========================================================================================
 #if defined(unix) || defined(__unix__) || defined(__unix)
@@ -28,52 +77,192 @@ void SetupTerminal()
     // does not require setup
 }
 
-void Terminal_ClearArea(uint8_t X, uint8_t Y, uint8_t W, uint8_t H)
+void Terminal_ClearArea(uint16_t X, uint16_t Y, uint16_t W, uint16_t H)
 {
-    for (uint8_t currY = Y; currY < Y+H; currY++) // rows
+    if (W == 0 || H == 0)
+        return; // nothing to clear - and no zero-length buffer
+
+    char spaces[W];
+    memset(spaces, ' ', W);
+
+    Terminal_BeginFrame(); // the whole area goes out in one write
+    for (uint32_t currY = Y; currY < (uint32_t)Y+H; currY++) // rows
     {
         Terminal_SetCursorPosition(X, currY);
-        for (uint8_t currX = X; currX < X+W; currX++)
-            printf(" ");
+        Terminal_Write(spaces, W);
     }
+    Terminal_EndFrame();
 }
 
 // VT100 escape codes:
-void Terminal_SetCursorPosition(uint16_t X, uint16_t Y)
+// (the functions return the number of bytes sent to the terminal)
+int Terminal_SetCursorPosition(uint16_t X, uint16_t Y)
 {
-    putc(0x1B, stdout);
-    printf("[%u;%uf", Y, X);
+    char escape[16];
+    char* end = escape;
+
+    *end++ = 0x1B; *end++ = '[';
+    end = Terminal_FormatUInt(end, Y);
+    *end++ = ';';
+    end = Terminal_FormatUInt(end, X);
+    *end++ = 'f';
+
+    countEscapes(1);
+    return Terminal_Write(escape, end - escape);
 }
 
-void Terminal_SetStyle(ConsoleStyleText text, ConsoleStyleBackground bg)
+int Terminal_SetStyle(ConsoleStyleText text, ConsoleStyleBackground bg)
 {
-    putc(0x1B, stdout);
+    char escape[24];
+    char* end = escape;
+
+    *end++ = 0x1B; *end++ = '[';
     if (text == CONSOLE_STYLE_TEXT_WHITE)
-        printf("[37;1m");
+    {
+        memcpy(end, "37;1", 4);
+        end += 4;
+    }
     else
-        printf("[%um", text);
+    {
+        memcpy(end, "22;", 3); // normal intensity: white turns bold on
+        end += 3;
+        end = Terminal_FormatUInt(end, text);
+    }
+    *end++ = 'm';
+
+    *end++ = 0x1B; *end++ = '[';
+    end = Terminal_FormatUInt(end, bg);
+    *end++ = 'm';
 
-    putc(0x1B, stdout);
-    printf("[%um", bg);
+    countEscapes(2);
+    return Terminal_Write(escape, end - escape);
 }
 
-void Terminal_SaveCursorPosition()
+// appends the SGR parameters of one color: "base" is 30 for the text and 40 for the background
+static char* Terminal_FormatColor(char* out, TerminalColor color, uint32_t base)
 {
-    printf("\x1B"); printf("7");
+    switch (TERMINAL_COLOR_KIND(color))
+    {
+        case 1: // ansi: 0...7 normal, 8...15 bright
+            if ((color & 0x0F) < 8)
+                return Terminal_FormatUInt(out, base + (color & 0x07));
+            else
+                return Terminal_FormatUInt(out, base + 60 + (color & 0x07));
+
+        case 2: // palette
+            out = Terminal_FormatUInt(out, base + 8);
+            memcpy(out, ";5;", 3);
+            return Terminal_FormatUInt(out + 3, color & 0xFF);
+
+        default: // rgb
+            out = Terminal_FormatUInt(out, base + 8);
+            memcpy(out, ";2;", 3);
+            out = Terminal_FormatUInt(out + 3, (color >> 16) & 0xFF);
+            *out++ = ';';
+            out = Terminal_FormatUInt(out, (color >> 8) & 0xFF);
+            *out++ = ';';
+            return Terminal_FormatUInt(out, color & 0xFF);
+    }
 }
 
-void Terminal_RestoreCursorSavedPosition()
+int Terminal_SetColor(TerminalColor foreground, TerminalColor background)
 {
-    printf("\x1B"); printf("8");
+    if (foreground == TERMINAL_COLOR_DEFAULT && background == TERMINAL_COLOR_DEFAULT)
+        return 0;
+
+    char escape[48];
+    char* end = escape;
+
+    *end++ = 0x1B; *end++ = '[';
+    if (foreground != TERMINAL_COLOR_DEFAULT)
+        end = Terminal_FormatColor(end, foreground, 30);
+
+    if (background != TERMINAL_COLOR_DEFAULT)
+    {
+        if (foreground != TERMINAL_COLOR_DEFAULT)
+            *end++ = ';';
+
+        end = Terminal_FormatColor(end, background, 40);
+    }
+    *end++ = 'm';
+
+    countEscapes(1);
+    return Terminal_Write(escape, end - escape);
+}
+
+int Terminal_SaveCursorPosition()
+{
+    countEscapes(1);
+    return Terminal_Write("\x1B" "7", 2);
+}
+
+int Terminal_RestoreCursorSavedPosition()
+{
+    countEscapes(1);
+    return Terminal_Write("\x1B" "8", 2);
+}
+
+// the size is asked to the terminal only once, and again after every SIGWINCH
+static volatile sig_atomic_t terminal_size_stale = 1;
+static volatile sig_atomic_t terminal_resized = 0;
+static uint16_t terminal_width = 0;
+static uint16_t terminal_height = 0;
+static uint8_t terminal_handler_installed = 0;
+static struct sigaction terminal_previous_handler;
+
+static void Terminal_OnResize(int sig)
+{
+    terminal_size_stale = 1;
+    terminal_resized = 1;
+
+    // the application may be listening too
+    if (!(terminal_previous_handler.sa_flags & SA_SIGINFO) &&
+        terminal_previous_handler.sa_handler != SIG_DFL && terminal_previous_handler.sa_handler != SIG_IGN)
+        terminal_previous_handler.sa_handler(sig);
+}
+
+void Terminal_GetSize(uint16_t *WidthColumns, uint16_t *RowsHeight)
+{
+    if (!terminal_handler_installed)
+    {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = Terminal_OnResize;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+
+        sigaction(SIGWINCH, &action, &terminal_previous_handler);
+        terminal_handler_installed = 1;
+    }
+
+    if (terminal_size_stale)
+    {
+        terminal_size_stale = 0; // a resize during the ioctl marks it stale again
+
+        struct winsize w;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0)
+        {
+            terminal_height = w.ws_row; // atoi(getenv("LINES"));
+            terminal_width = w.ws_col; //atoi(getenv("COLUMNS"));
+        }
+    }
+
+    *RowsHeight = terminal_height;
+    *WidthColumns = terminal_width;
 }
 
-void Terminal_GetSize(uint8_t *WidthColumns, uint8_t *RowsHeight)
+// true once after the terminal was resized - the canvases can follow with BrailleCanvas_Resize
+uint8_t Terminal_Resized()
 {
-    struct winsize w;
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+    if (!terminal_handler_installed) // nothing to compare with yet
+    {
+        uint16_t w, h;
+        Terminal_GetSize(&w, &h);
+    }
 
-    *RowsHeight = (uint8_t)w.ws_row; // atoi(getenv("LINES"));
-    *WidthColumns = (uint8_t)w.ws_col; //atoi(getenv("COLUMNS"));
+    uint8_t resized = terminal_resized;
+    terminal_resized = 0;
+    return resized;
 }
 
 #endif // defined
@@ -106,23 +295,39 @@ void SetupTerminal()
     if (SetWindowsConsoleFont(myFontIndex)) // A FONT THAT SUPPORTS BOTH BRAILLE AND EXTENDED-ASCII*/
         SetConsoleOutputCP(CP_UTF8); // SET CODEPAGE TO UTF-8
 }
-void Terminal_GetSize(uint8_t *WidthColumns, uint8_t *HeightRows)
+void Terminal_GetSize(uint16_t *WidthColumns, uint16_t *HeightRows)
 {
     CONSOLE_SCREEN_BUFFER_INFO csbi;
 
     if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi))
     {
-        *WidthColumns = (uint8_t)csbi.dwSize.X;
-        *HeightRows = (uint8_t)(csbi.srWindow.Bottom - csbi.srWindow.Top + 1);//csbi.dwSize.Y;
+        *WidthColumns = (uint16_t)csbi.dwSize.X;
+        *HeightRows = (uint16_t)(csbi.srWindow.Bottom - csbi.srWindow.Top + 1);//csbi.dwSize.Y;
     }
 }
 
-void Terminal_ClearArea(uint8_t X, uint8_t Y, uint8_t W, uint8_t H)
+// the console has no resize signal: compare with the size seen on the previous call
+uint8_t Terminal_Resized()
+{
+    static uint16_t lastWidth = 0, lastHeight = 0;
+
+    uint16_t w = lastWidth, h = lastHeight;
+    Terminal_GetSize(&w, &h);
+
+    uint8_t resized = (lastWidth || lastHeight) && (w != lastWidth || h != lastHeight);
+    lastWidth = w;
+    lastHeight = h;
+    return resized;
+}
+
+void Terminal_ClearArea(uint16_t X, uint16_t Y, uint16_t W, uint16_t H)
 {
+    Terminal_Lock();
+    Terminal_FlushFrame(); // the console is written right away: the text of the frame so far goes first
     HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
     CONSOLE_SCREEN_BUFFER_INFO csbi;
 
-    for (uint8_t line = 0; line < H; line++)
+    for (uint16_t line = 0; line < H; line++)
     {
         DWORD cCharsWritten;
         COORD coordScreen = { X, Y+line };
@@ -130,20 +335,25 @@ void Terminal_ClearArea(uint8_t X, uint8_t Y, uint8_t W, uint8_t H)
         GetConsoleScreenBufferInfo( hConsole, &csbi );
         FillConsoleOutputAttribute( hConsole, csbi.wAttributes, (DWORD)W, coordScreen, &cCharsWritten ); // print the style (color, bg, etc..)
     }
+    Terminal_Unlock();
 }
 
-void Terminal_SetCursorPosition(uint16_t X, uint16_t Y)
+int Terminal_SetCursorPosition(uint16_t X, uint16_t Y)
 {
-    fflush(stdout);
+    Terminal_Lock();
+    Terminal_FlushFrame(); // the text before the move must reach the console first
     COORD coordScreen = { X, Y };
     SetConsoleCursorPosition(GetStdHandle(STD_OUTPUT_HANDLE), coordScreen);
+    Terminal_Unlock();
+    return 0; // console API calls do not go through the output stream
 }
 
 uint16_t ___private_saved_cursor_x;
 uint16_t ___private_saved_cursor_y;
-void Terminal_SaveCursorPosition()
+int Terminal_SaveCursorPosition()
 {
-    fflush(stdout);
+    Terminal_Lock();
+    Terminal_FlushFrame();
     CONSOLE_SCREEN_BUFFER_INFO csbi;
 
     if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi))
@@ -151,16 +361,51 @@ void Terminal_SaveCursorPosition()
         ___private_saved_cursor_x = csbi.dwCursorPosition.X;
         ___private_saved_cursor_y = csbi.dwCursorPosition.Y;
     }
+
+    Terminal_Unlock();
+    return 0;
 }
 
-void Terminal_RestoreCursorSavedPosition()
+int Terminal_RestoreCursorSavedPosition()
 {
-    Terminal_SetCursorPosition(___private_saved_cursor_x, ___private_saved_cursor_y);
+    return Terminal_SetCursorPosition(___private_saved_cursor_x, ___private_saved_cursor_y);
 }
 
-void Terminal_SetStyle(ConsoleStyleText text, ConsoleStyleBackground bg)
+int Terminal_SetStyle(ConsoleStyleText text, ConsoleStyleBackground bg)
 {
+    Terminal_Lock();
+    Terminal_FlushFrame(); // the text before the change keeps the attribute it was written with
     SetConsoleTextAttribute(GetStdHandle(STD_OUTPUT_HANDLE), text | bg);
+    Terminal_Unlock();
+    return 0;
+}
+
+// the console only knows the 16 colors: palette and rgb colors leave the attribute untouched
+int Terminal_SetColor(TerminalColor foreground, TerminalColor background)
+{
+    // ansi numbers the colors red=1, green=2, blue=4 - the console attributes have them the other way around
+    static const WORD ANSI_TO_CONSOLE[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+    Terminal_Lock();
+    Terminal_FlushFrame();
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    if (!GetConsoleScreenBufferInfo(hConsole, &csbi))
+    {
+        Terminal_Unlock();
+        return 0;
+    }
+
+    WORD attributes = csbi.wAttributes;
+    if (TERMINAL_COLOR_KIND(foreground) == 1)
+        attributes = (attributes & 0xFFF0) | ANSI_TO_CONSOLE[foreground & 0x07] | ((foreground & 0x08) ? FOREGROUND_INTENSITY : 0);
+
+    if (TERMINAL_COLOR_KIND(background) == 1)
+        attributes = (attributes & 0xFF0F) | (ANSI_TO_CONSOLE[background & 0x07] << 4) | ((background & 0x08) ? BACKGROUND_INTENSITY : 0);
+
+    SetConsoleTextAttribute(hConsole, attributes);
+    Terminal_Unlock();
+    return 0;
 }
 
 #endif
@@ -213,31 +458,462 @@ int utf8_encode(char *out, uint32_t utf)
     }
 }
 
+// OUTPUT SINKS
+//===========================================================================================
+// writes to a file descriptor, retrying on partial writes and interruptions
+// a non-blocking descriptor stops as soon as it is full, and the bytes taken so far are returned
+static int Terminal_WriteDescriptor(int descriptor, const char* data, size_t size)
+{
+    size_t written = 0;
+    while (written < size)
+    {
+        int result = (int)write(descriptor, data + written, size - written);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break; // EAGAIN on a non-blocking descriptor, or a real error
+        }
+
+        written += result;
+    }
+
+    return (int)written;
+}
+
+// stdio: small writes collect in the stream buffer, while large blocks (whole frames) go out in a single write
+static int TerminalSink_StdioWrite(TerminalSink* sink, const char* data, size_t size)
+{
+    if (size < BUFSIZ)
+        return (int)fwrite(data, sizeof(char), size, sink->Stream);
+
+    fflush(sink->Stream); // whatever the stream holds must come out first
+    return Terminal_WriteDescriptor(sink->Descriptor, data, size);
+}
+
+static int TerminalSink_StdioFlush(TerminalSink* sink)
+{
+    return fflush(sink->Stream);
+}
+
+static int TerminalSink_DescriptorWrite(TerminalSink* sink, const char* data, size_t size)
+{
+    return Terminal_WriteDescriptor(sink->Descriptor, data, size);
+}
+
+static int TerminalSink_NoFlush(TerminalSink* sink)
+{
+    return 0;
+}
+
+static int TerminalSink_MemoryWrite(TerminalSink* sink, const char* data, size_t size)
+{
+    if (sink->Length + size > sink->Capacity)
+    {
+        size_t capacity = max(2 * sink->Capacity, sink->Length + size);
+        char* grown = (char*)realloc(sink->Data, capacity);
+        if (!grown)
+        {
+            fprintf(stderr, "\nTerminal sink memory allocation has failed\n");
+            return 0;
+        }
+
+        sink->Data = grown;
+        sink->Capacity = capacity;
+    }
+
+    memcpy(&sink->Data[sink->Length], data, size);
+    sink->Length += size;
+
+    return (int)size;
+}
+
+// BACKLOG OF NON-BLOCKING SINKS
+// a frame the terminal takes only in part is not lost: the rest waits in the sink and goes out, in order, before anything written later
+//===========================================================================================
+// appends bytes to the backlog - returns 0 on success
+static int TerminalSink_Keep(TerminalSink* sink, const char* data, size_t size)
+{
+    if (sink->BacklogStart > 0) // the bytes already sent are dropped from the front
+    {
+        memmove(sink->Backlog, &sink->Backlog[sink->BacklogStart], sink->BacklogLength);
+        sink->BacklogStart = 0;
+    }
+
+    if (sink->BacklogLength + size > sink->BacklogCapacity)
+    {
+        size_t capacity = max(2 * sink->BacklogCapacity, sink->BacklogLength + size);
+        char* grown = (char*)realloc(sink->Backlog, capacity);
+        if (!grown)
+        {
+            fprintf(stderr, "\nTerminal sink backlog allocation has failed\n");
+            return -1;
+        }
+
+        sink->Backlog = grown;
+        sink->BacklogCapacity = capacity;
+    }
+
+    memcpy(&sink->Backlog[sink->BacklogLength], data, size);
+    sink->BacklogLength += size;
+
+    return 0;
+}
+
+// sends as much of the backlog as the sink takes and returns the number of bytes still waiting
+static size_t TerminalSink_Drain(TerminalSink* sink)
+{
+    if (sink->BacklogLength > 0)
+    {
+        int taken = sink->Write(sink, &sink->Backlog[sink->BacklogStart], sink->BacklogLength);
+        if (taken > 0)
+        {
+            sink->BacklogStart += taken;
+            sink->BacklogLength -= taken;
+        }
+
+        if (sink->BacklogLength == 0)
+            sink->BacklogStart = 0;
+    }
+
+    return sink->BacklogLength;
+}
+
+// writes to the sink: a non-blocking sink keeps whatever it cannot take now, so the bytes are always taken in full and in order
+static int TerminalSink_Send(TerminalSink* sink, const char* data, size_t size)
+{
+    if (!(sink->Capabilities & TERMINAL_SINK_NONBLOCKING))
+        return sink->Write(sink, data, size);
+
+    size_t taken = 0;
+    if (TerminalSink_Drain(sink) == 0) // nothing may overtake the backlog
+    {
+        int result = sink->Write(sink, data, size);
+        taken = result > 0 ? (size_t)result : 0;
+    }
+
+    if (taken < size)
+    {
+        sink->Stalls++;
+        if (TerminalSink_Keep(sink, data + taken, size - taken) != 0)
+            return (int)taken;
+    }
+
+    return (int)size;
+}
+//===========================================================================================
+
+void TerminalSink_CreateStdio(TerminalSink* sink, FILE* stream)
+{
+    memset(sink, 0, sizeof(TerminalSink));
+    sink->Write = TerminalSink_StdioWrite;
+    sink->Flush = TerminalSink_StdioFlush;
+    sink->Stream = stream;
+    sink->Descriptor = fileno(stream);
+    sink->Capabilities = TERMINAL_SINK_BUFFERED | (isatty(sink->Descriptor) ? TERMINAL_SINK_TTY : 0);
+}
+
+void TerminalSink_CreateDescriptor(TerminalSink* sink, int descriptor)
+{
+    memset(sink, 0, sizeof(TerminalSink));
+    sink->Write = TerminalSink_DescriptorWrite;
+    sink->Flush = TerminalSink_NoFlush;
+    sink->Descriptor = descriptor;
+    sink->Capabilities = isatty(descriptor) ? TERMINAL_SINK_TTY : 0;
+
+    #if defined(unix) || defined(__unix__) || defined(__unix)
+    int flags = fcntl(descriptor, F_GETFL);
+    if (flags != -1 && (flags & O_NONBLOCK))
+        sink->Capabilities |= TERMINAL_SINK_NONBLOCKING;
+    #endif
+}
+
+// keeps the output in memory - for headless rendering and snapshots of the frames
+void TerminalSink_CreateMemory(TerminalSink* sink)
+{
+    memset(sink, 0, sizeof(TerminalSink));
+    sink->Write = TerminalSink_MemoryWrite;
+    sink->Flush = TerminalSink_NoFlush;
+    sink->Descriptor = -1;
+}
+
+// makes the writes of a descriptor sink return at once instead of waiting for a slow terminal - a stdio sink then bypasses its stream
+// the flag belongs to the open file: when stdin and stdout share the terminal, reading it becomes non-blocking too
+// returns 0 on success
+int TerminalSink_SetNonBlocking(TerminalSink* sink, uint8_t enable)
+{
+    #if defined(unix) || defined(__unix__) || defined(__unix)
+    if (sink->Descriptor < 0)
+    {
+        fprintf(stderr, "TerminalSink_SetNonBlocking: the sink has no file descriptor\n");
+        return -1;
+    }
+
+    if (sink->Stream)
+        fflush(sink->Stream); // the stream must be empty before its writes are bypassed
+
+    int flags = fcntl(sink->Descriptor, F_GETFL);
+    if (flags == -1 || fcntl(sink->Descriptor, F_SETFL, enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) == -1)
+    {
+        fprintf(stderr, "TerminalSink_SetNonBlocking: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (sink->Stream)
+        sink->Write = enable ? TerminalSink_DescriptorWrite : TerminalSink_StdioWrite;
+
+    if (enable)
+        sink->Capabilities |= TERMINAL_SINK_NONBLOCKING;
+    else
+    {
+        sink->Capabilities &= ~TERMINAL_SINK_NONBLOCKING;
+        TerminalSink_Drain(sink); // the writes wait again: the backlog goes out now
+    }
+
+    return 0;
+    #else
+    fprintf(stderr, "TerminalSink_SetNonBlocking: not supported on this platform\n");
+    return -1;
+    #endif
+}
+
+// a backlog still waiting in a non-blocking sink is discarded
+void TerminalSink_Destroy(TerminalSink* sink)
+{
+    if (sink->Flush)
+        sink->Flush(sink);
+
+    free(sink->Data);
+    free(sink->Backlog);
+    memset(sink, 0, sizeof(TerminalSink));
+}
+
+static TerminalSink terminal_stdout;
+static TerminalSink* terminal_sink = NULL;
+
+TerminalSink* Terminal_GetSink()
+{
+    if (!terminal_sink) // the default: stdout
+    {
+        if (!terminal_stdout.Write)
+            TerminalSink_CreateStdio(&terminal_stdout, stdout);
+
+        terminal_sink = &terminal_stdout;
+    }
+
+    return terminal_sink;
+}
+
+// replaces the sink and returns the previous one - NULL goes back to stdout
+TerminalSink* Terminal_SetSink(TerminalSink* sink)
+{
+    Terminal_Lock();
+    TerminalSink* previous = Terminal_GetSink();
+    previous->Flush(previous);
+
+    terminal_sink = sink;
+    Terminal_Unlock();
+    return previous;
+}
+
+// a non-blocking sink only sends what the terminal takes now - Terminal_Drain tells how much is left
+int Terminal_Flush()
+{
+    Terminal_Lock();
+    TerminalSink* sink = Terminal_GetSink();
+    TerminalSink_Drain(sink);
+    int flushed = sink->Flush(sink);
+    Terminal_Unlock();
+    return flushed;
+}
+
+// sends the bytes a non-blocking sink is still holding back and returns the number of bytes left - 0 once the terminal caught up
+size_t Terminal_Drain()
+{
+    Terminal_Lock();
+    size_t left = TerminalSink_Drain(Terminal_GetSink());
+    Terminal_Unlock();
+    return left;
+}
+
+// asked by the renderers before they build a frame: while a non-blocking sink is still sending an earlier frame, the new one is
+// skipped - the cells stay dirty, so the next frame that goes out carries all the changes at once
+uint8_t Terminal_Ready()
+{
+    return Terminal_Drain() == 0;
+}
+
+// called by a renderer giving up on a frame because the terminal was not ready: counted once per frame
+void Terminal_DropFrame()
+{
+    Terminal_Lock();
+    Terminal_GetSink()->Dropped++;
+    Terminal_Unlock();
+}
+
+void Terminal_GetBackpressure(TerminalBackpressure* backpressure)
+{
+    Terminal_Lock();
+    TerminalSink* sink = Terminal_GetSink();
+    backpressure->Pending = sink->BacklogLength;
+    backpressure->Stalls = sink->Stalls;
+    backpressure->Dropped = sink->Dropped;
+    Terminal_Unlock();
+}
+//===========================================================================================
+
+// FRAME BUFFER
+// between Terminal_BeginFrame and Terminal_EndFrame everything sent to the terminal is held in memory
+// and goes out in a single write when the outermost frame ends
+//===========================================================================================
+static char* terminal_frame = NULL;
+static size_t terminal_frame_length = 0;
+static size_t terminal_frame_capacity = 0;
+static int terminal_frame_depth = 0;
+static uint8_t terminal_frame_failed = 0; // the buffer could not grow: the frame is incomplete and is not sent
+
+// the frame holds the terminal lock until it ends: other threads wait instead of writing into it
+void Terminal_BeginFrame()
+{
+    Terminal_Lock();
+    terminal_frame_depth++;
+}
+
+// returns the number of bytes sent, -1 when the frame was lost
+int Terminal_EndFrame()
+{
+    Terminal_Lock();
+    if (terminal_frame_depth == 0) // unbalanced call
+    {
+        Terminal_Unlock();
+        return 0;
+    }
+
+    int written = 0;
+    if (--terminal_frame_depth > 0)
+        ; // an outer frame is still being built
+    else if (terminal_frame_failed)
+    {
+        terminal_frame_failed = 0;
+        terminal_frame_length = 0;
+        written = -1;
+    }
+    else
+    {
+        TerminalSink* sink = Terminal_GetSink();
+        written = TerminalSink_Send(sink, terminal_frame, terminal_frame_length);
+        sink->Flush(sink);
+        terminal_frame_length = 0;
+    }
+
+    Terminal_Unlock(); // the one taken by Terminal_BeginFrame
+    Terminal_Unlock();
+    return written;
+}
+
+// sends what the open frame holds so far, and keeps the frame open
+// the console API calls of Windows act at once, so they call this first: the text written before them reaches the screen before them
+int Terminal_FlushFrame()
+{
+    Terminal_Lock();
+
+    int written = -1;
+    if (terminal_frame_depth == 0)
+        written = Terminal_Flush();
+    else if (!terminal_frame_failed)
+    {
+        TerminalSink* sink = Terminal_GetSink();
+        written = TerminalSink_Send(sink, terminal_frame, terminal_frame_length);
+        sink->Flush(sink);
+        terminal_frame_length = 0;
+    }
+
+    Terminal_Unlock();
+    return written;
+}
+
+// sends bytes to the terminal (or to the frame being built) and returns the number of bytes
+// -1 when the frame buffer could not grow: the whole frame is then dropped by Terminal_EndFrame
+int Terminal_Write(const char* data, size_t size)
+{
+    Terminal_Lock();
+    countBytes(size);
+
+    int written = (int)size;
+    if (terminal_frame_depth == 0)
+        written = TerminalSink_Send(Terminal_GetSink(), data, size);
+    else if (terminal_frame_failed)
+        written = -1;
+    else
+    {
+        if (terminal_frame_length + size > terminal_frame_capacity)
+        {
+            size_t capacity = max(2 * terminal_frame_capacity, terminal_frame_length + size);
+            char* grown = (char*)realloc(terminal_frame, capacity);
+            if (grown)
+            {
+                terminal_frame = grown;
+                terminal_frame_capacity = capacity;
+            }
+            else
+            {
+                fprintf(stderr, "\nTerminal frame buffer allocation has failed\n");
+                terminal_frame_failed = 1;
+                written = -1;
+            }
+        }
+
+        if (written >= 0)
+        {
+            memcpy(&terminal_frame[terminal_frame_length], data, size);
+            terminal_frame_length += size;
+        }
+    }
+
+    Terminal_Unlock();
+    return written;
+}
+//===========================================================================================
+
 void Terminal_Clear()
 {
-    fflush(stdout); // guarantee no characters will be written from the buffer after the screen is clear
+    Terminal_Lock(); // no other thread writes between the flush and the clear
+    Terminal_Flush(); // guarantee no characters will be written from the buffer after the screen is clear
 
-    uint8_t W, H;
+    uint16_t W, H;
     Terminal_GetSize(&W, &H);
     Terminal_ClearArea(0, 0, W, H);
 
+    Terminal_Unlock();
     return;
 }
 
+// serializes the output of every thread: the frame functions and the functions sending bytes take it themselves,
+// and it is recursive, so a caller can hold it around a sequence of them (a frame, a cursor move and its text)
+static pthread_once_t terminal_lock_once = PTHREAD_ONCE_INIT;
 static char bTerminalMutexInitialized = 0;
-static pthread_mutex_t terminal_lock; //= NULL;
+static pthread_mutex_t terminal_lock;
+
+static void Terminal_CreateLock()
+{
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+
+    if (pthread_mutex_init(&terminal_lock, &attributes) != 0) // TRY CREATE IT
+        fprintf(stderr, "\nTerminal mutex init has failed\n");
+    else
+        bTerminalMutexInitialized = 1;
+
+    pthread_mutexattr_destroy(&attributes);
+}
+
 int Terminal_Lock()
 {
-    if (!bTerminalMutexInitialized) // MUTEX NOT YET CREATED
-    {
-        if (pthread_mutex_init(&terminal_lock, NULL) != 0) // TRY CREATE IT
-        {
-            fprintf(stderr, "\nTerminal mutex init has failed\n");
-            return -1;
-        }
-        else
-            bTerminalMutexInitialized = 1;
-    }
+    pthread_once(&terminal_lock_once, Terminal_CreateLock);
+    if (!bTerminalMutexInitialized)
+        return -1;
 
     return pthread_mutex_lock(&terminal_lock);
 }
@@ -19,6 +19,8 @@
 #define _TERMINAL_CANVAS_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
 
 // UNIX
 //===========================================================================================
@@ -95,15 +97,86 @@ typedef enum {
 
 #endif
 
-void Terminal_GetSize(uint8_t *, uint8_t *);
-void Terminal_ClearArea(uint8_t X, uint8_t Y, uint8_t W, uint8_t H);
-void Terminal_SetCursorPosition(uint16_t X, uint16_t Y);
-void Terminal_SetStyle(ConsoleStyleText, ConsoleStyleBackground);
-void Terminal_SaveCursorPosition();
-void Terminal_RestoreCursorSavedPosition();
+// colors beyond the console styles: the 16 ansi colors, the 256-color palette or 24-bit rgb
+// TERMINAL_COLOR_DEFAULT leaves the color set by Terminal_SetStyle untouched
+typedef uint32_t TerminalColor;
+
+#define TERMINAL_COLOR_DEFAULT 0
+#define TERMINAL_COLOR_ANSI(n) (0x01000000u | ((n) & 0x0F))
+#define TERMINAL_COLOR_256(n) (0x02000000u | ((n) & 0xFF))
+#define TERMINAL_COLOR_RGB(r,g,b) (0x03000000u | (((r) & 0xFF) << 16) | (((g) & 0xFF) << 8) | ((b) & 0xFF))
+#define TERMINAL_COLOR_KIND(c) ((c) >> 24)
+
+// OUTPUT SINKS
+// everything Terminal_* sends (the escapes and the canvas text) goes to the current sink: stdout unless Terminal_SetSink picked another
+// a custom sink only needs Write and Flush - for instance to forward the frames to several other sinks
+//===========================================================================================
+#define TERMINAL_SINK_TTY 0x01          // the bytes reach a terminal
+#define TERMINAL_SINK_BUFFERED 0x02     // the bytes may be held back until Flush
+#define TERMINAL_SINK_NONBLOCKING 0x04  // Write never waits, and may take only part of the bytes
+
+typedef struct TerminalSink TerminalSink;
+
+struct TerminalSink
+{
+    int (*Write)(TerminalSink*, const char*, size_t); // returns the number of bytes taken
+    int (*Flush)(TerminalSink*); // returns 0 on success
+    uint32_t Capabilities;
+
+    FILE* Stream;   // stdio sink
+    int Descriptor; // stdio and file descriptor sinks
+
+    char* Data;     // memory sink: everything written so far (not null-terminated)
+    size_t Length;  // can be set back to 0 to reuse the memory
+    size_t Capacity;
+
+    // non-blocking sinks: the bytes the sink could not take yet, sent before anything else by Terminal_Drain
+    char* Backlog;
+    size_t BacklogStart;
+    size_t BacklogLength;
+    size_t BacklogCapacity;
+    uint64_t Stalls;    // writes the sink took only in part
+    uint64_t Dropped;   // frames skipped because the sink was still busy
+};
+
+// how far behind a (non-blocking) sink is - applications can lower their update rate while it is behind
+typedef struct
+{
+    size_t Pending;     // bytes of earlier frames still waiting for the terminal
+    uint64_t Stalls;    // writes the terminal took only in part
+    uint64_t Dropped;   // frames skipped by the renderers because the terminal was still busy
+} TerminalBackpressure;
+
+void TerminalSink_CreateStdio(TerminalSink*, FILE*);
+void TerminalSink_CreateDescriptor(TerminalSink*, int);
+void TerminalSink_CreateMemory(TerminalSink*);
+void TerminalSink_Destroy(TerminalSink*);
+int TerminalSink_SetNonBlocking(TerminalSink*, uint8_t);
+TerminalSink* Terminal_SetSink(TerminalSink*);
+TerminalSink* Terminal_GetSink();
+int Terminal_Flush();
+void Terminal_GetCounters(uint64_t* bytes, uint64_t* escapes);
+size_t Terminal_Drain();
+uint8_t Terminal_Ready();
+void Terminal_DropFrame();
+void Terminal_GetBackpressure(TerminalBackpressure*);
+//===========================================================================================
+
+void Terminal_GetSize(uint16_t *, uint16_t *);
+uint8_t Terminal_Resized();
+void Terminal_ClearArea(uint16_t X, uint16_t Y, uint16_t W, uint16_t H);
+int Terminal_SetCursorPosition(uint16_t X, uint16_t Y);
+int Terminal_SetStyle(ConsoleStyleText, ConsoleStyleBackground);
+int Terminal_SetColor(TerminalColor foreground, TerminalColor background);
+int Terminal_SaveCursorPosition();
+int Terminal_RestoreCursorSavedPosition();
 void SetupTerminal();
 void Terminal_PrintUnicode(uint32_t);
 void Terminal_Clear();
+void Terminal_BeginFrame();
+int Terminal_EndFrame();
+int Terminal_FlushFrame();
+int Terminal_Write(const char*, size_t);
 int Terminal_Lock();
 int Terminal_Unlock();
 int utf8_encode(char *out, uint32_t utf);